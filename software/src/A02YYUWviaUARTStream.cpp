@@ -24,6 +24,11 @@ A02YYUWviaUARTStream::A02YYUWviaUARTStream(Stream* mUARTSerial, uint8_t modeSele
   setProcessed(processed);
 }
 
+A02YYUWviaUARTStream::A02YYUWviaUARTStream(MUARTSingleStream* mUARTSerial, uint8_t modeSelectPin, bool processed)
+  : A02YYUWviaUARTStream((Stream*) mUARTSerial, modeSelectPin, processed) {
+  mBoardUART = mUARTSerial;
+}
+
 /*******************************
  * Getters / Setters
  *******************************/
@@ -32,6 +37,11 @@ float A02YYUWviaUARTStream::getDistance() {
   return mLastMeasuredDistance;
 }
 
+// Get the last measured distance as an integer / mm
+uint16_t A02YYUWviaUARTStream::getDistanceMM() {
+  return mLastMeasuredDistance;
+}
+
 // Returns true if the sensor is returning processed data, otherwise its returning real-time data
 bool A02YYUWviaUARTStream::isProcessed() {
   return mProcessed;
@@ -40,7 +50,9 @@ bool A02YYUWviaUARTStream::isProcessed() {
 // Set processed = true to get the sensor do some pre-processing to reduce noise, otherwise the sensor will return real-time data
 void A02YYUWviaUARTStream::setProcessed(bool processed) {
   mProcessed = processed;
-  digitalWrite(mModeSelectPin, processed ? HIGH : LOW);
+  endTrigger();
+  // The sensor sends packets at a different rate in each mode, so start measuring it again
+  mFrameInterval = IntegerFilters::EMAFilter<2>();
 }
 
 // For Debug purposes: The last time the sensor was asked to update the distance reading / ms since last reset
@@ -53,7 +65,7 @@ unsigned long A02YYUWviaUARTStream::getLastReadSuccess() {
   return mLastReadSuccess;
 }
 
-// For Debug purposes: The result of the last read request: -1 if there's a checksum error, -2 if the frame wasn't read correctly, otherwise a distance in mm
+// For Debug purposes: The result of the last read request: 0 if successful, -1 if a packet failed its checksum, -4 if a triggered measurement timed out
 int A02YYUWviaUARTStream::getLastReadResult() {
   return mLastReadResult;
 }
@@ -67,74 +79,205 @@ int A02YYUWviaUARTStream::getLastReadStatus() {
   return mLastReadStatus;
 }
 
+// Returns true if each read uses the newest valid packet available and discards any older ones
+bool A02YYUWviaUARTStream::isLatestWins() {
+  return mLatestWins;
+}
+
+// Set latestWins = true to have each read report the newest valid packet and discard older ones
+void A02YYUWviaUARTStream::setLatestWins(bool latestWins) {
+  mLatestWins = latestWins;
+}
+
+// The estimated time the packet behind the last successful reading finished arriving / ms since reset
+unsigned long A02YYUWviaUARTStream::getLastFrameTime() {
+  return mLastFrameTime;
+}
+
+// Returns true if the sensor only measures when asked to by requestMeasurement()
+bool A02YYUWviaUARTStream::isTriggered() {
+  return mTriggered;
+}
+
+// Set triggered = true to only take measurements when requested (the sensor must have UART controlled output)
+void A02YYUWviaUARTStream::setTriggered(bool triggered) {
+  mTriggered = triggered;
+  mMeasurementPending = false;
+  endTrigger();
+}
+
+// Time to wait for the packet from a triggered measurement before giving up / ms
+unsigned long A02YYUWviaUARTStream::getTriggerTimeout() {
+  return mTriggerTimeout;
+}
+
+void A02YYUWviaUARTStream::setTriggerTimeout(unsigned long timeoutMs) {
+  mTriggerTimeout = timeoutMs;
+}
+
+// Returns true if a triggered measurement has been requested and its packet hasn't arrived yet
+bool A02YYUWviaUARTStream::isMeasurementPending() {
+  return mMeasurementPending;
+}
+
+// Time between the last successful triggered measurement being requested and its packet being read / us
+unsigned long A02YYUWviaUARTStream::getLastLatency() {
+  return mLastLatency;
+}
+
+// Returns true if reads are scheduled from the measured time between packets
+bool A02YYUWviaUARTStream::isAdaptiveInterval() {
+  return mAdaptiveInterval;
+}
+
+void A02YYUWviaUARTStream::setAdaptiveInterval(bool adaptiveInterval) {
+  mAdaptiveInterval = adaptiveInterval;
+}
+
+// Running estimate of the time between packets from the sensor / ms
+unsigned long A02YYUWviaUARTStream::getFrameInterval() {
+  return mFrameInterval.value();
+}
+
+// How long after the last packet reads start again / ms
+unsigned long A02YYUWviaUARTStream::getReadInterval() {
+  unsigned long frameInterval = mFrameInterval.value();
+  if (!mAdaptiveInterval || frameInterval == 0) return READ_INTERVAL_MS;
+  // Start a quarter of an interval early - packets are only ever read late otherwise, so the estimate could never come down
+  return frameInterval - frameInterval / 4;
+}
+
 /*******************************
  * Actions
  *******************************/
-// Reads the distance from the sensor (returns 0 if successful, -1 if there's a checksum error, -2 if the frame wasn't read correctly). If there wasn't enough data available, or this was called before the next read interval is due, then this returns 0;
+// Reads the distance from the sensor (returns 0 if successful, -1 if a packet failed its checksum). If there wasn't enough data available, or this was called before the next read interval is due, then this returns the previous result;
 int A02YYUWviaUARTStream::readDistance() {
+  if (mTriggered) {
+    readTriggeredDistance();
+    return mLastReadResult;
+  }
+
   byte data[PACKET_SIZE];
   unsigned long now = millis();
-  // Note: There's a minimum 100ms between readings at best, so don't read if it's not been 100ms since the last correctly formatted reading
-  if (now - mLastReadTime >= READ_INTERVAL_MS) {
-    mLastReadStatus = readSensorData(data);
-    if (mLastReadStatus == 0) {
-      mLastReadSuccess = now;
-      int result = processData(data);
-      // A negative result is an error code
-      if (result > 0) {
-        mLastMeasuredDistance = result;
-        mLastReadResult = 0; // success
-      } else {
-        mLastReadResult = result;
+  /* Note: There's a minimum 100ms between readings at best (up to 300ms in
+   * processed mode), so don't read until the next packet is due: the read
+   * interval after the last packet arrived (or after the last correctly
+   * formatted reading if the interval isn't adaptive). After that, keep
+   * trying so that a packet that's only partly arrived is picked up as soon
+   * as the rest of it turns up. */
+  unsigned long lastRead = mAdaptiveInterval ? mLastFrameTime : mLastReadSuccess;
+  if (mLastReadSuccess == 0 || now - lastRead >= getReadInterval()) {
+    unsigned long frameAgeUs = 0;
+    unsigned long checksumErrors = mPacketReader.getChecksumErrorCount();
+    mLastReadStatus = mLatestWins ? readLatestSensorData(data, frameAgeUs) : readSensorData(data);
+    reportChecksumErrors(checksumErrors);
+    if (mLastReadStatus != 0 && mPacketReader.getChecksumErrorCount() != checksumErrors) {
+      // A packet arrived but it was corrupted
+      mLastReadResult = -1;
+    } else if (mLastReadStatus == 0) {
+      unsigned long frameTime = now - frameAgeUs / 1000;
+      // Learn how often the sensor actually sends packets, ignoring gaps where packets were missed
+      if (mLastReadSuccess != 0 && frameTime - mLastFrameTime <= MAX_FRAME_INTERVAL_MS) {
+        mFrameInterval.update(frameTime - mLastFrameTime);
       }
+      mLastReadSuccess = now;
+      mLastFrameTime = frameTime;
+      mLastMeasuredDistance = processData(data);
+      mLastReadResult = 0; // success
+      onReading(mLastMeasuredDistance);
     }
     mLastReadTime = now;
   }
   return mLastReadResult;
 }
 
-int A02YYUWviaUARTStream::readSensorData(byte* data) {
-  if (mSensorUART->available() < PACKET_SIZE) return -1;
-
-  // Read until we find the header byte or run out of data
-  while (mSensorUART->available()) {
-    byte firstByte = mSensorUART->read();
-    if (firstByte == HEADER_BYTE) {
-      data[0] = firstByte;
-      break;
-    }
-  }
+// Pull the mode select line low - a sensor with UART controlled output takes one measurement on the falling edge
+void A02YYUWviaUARTStream::startTrigger() {
+  digitalWrite(mModeSelectPin, LOW);
+}
+
+// Return the mode select line to the level for the current mode (triggered mode idles high)
+void A02YYUWviaUARTStream::endTrigger() {
+  digitalWrite(mModeSelectPin, (mProcessed || mTriggered) ? HIGH : LOW);
+}
 
-  // If we didn't find the header byte, return false
-  if (data[0] != HEADER_BYTE) return -2;
+// Triggered mode: discard anything the sensor sent earlier and trigger a single measurement
+bool A02YYUWviaUARTStream::requestMeasurement() {
+  if (!mTriggered) return false;
 
-  // Read the rest of the packet
-  if (mSensorUART->available() >= PACKET_SIZE - 1) {
-    // Note: Pointer arithmetic below to ensure we're only filling the byte array _after_ the first byte.
-    mSensorUART->readBytes(data+1, PACKET_SIZE - 1);
+  // Anything already here is from before the request, so make sure it isn't mistaken for the answer
+  mPacketReader.reset();
+  if (mBoardUART) {
+    // available() may only report what's buffered locally (no auto refill, or a poll isn't due yet), so clear the board too
+    mBoardUART->drain();
   } else {
-    return -3; // Incomplete packet
+    while (mSensorUART->available()) mSensorUART->read();
   }
 
-  return 0;
+  startTrigger();
+  delayMicroseconds(TRIGGER_PULSE_US);
+  endTrigger();
+  mTriggerTime = micros();
+  mMeasurementPending = true;
+  return true;
 }
 
-int A02YYUWviaUARTStream::processData(const byte* data) {
-  if (data[0] != HEADER_BYTE) {
-    // Invalid data packet
-    return -2;
-  }
+// Triggered mode: trigger a single measurement and wait for its packet
+int A02YYUWviaUARTStream::measure() {
+  if (!requestMeasurement()) return mLastReadResult;
+  while (mMeasurementPending) readTriggeredDistance();
+  return mLastReadResult;
+}
+
+void A02YYUWviaUARTStream::readTriggeredDistance() {
+  if (!mMeasurementPending) return;
 
-  byte checksum = (data[0] + data[1] + data[2]) & 0xFF;
-  if (checksum != data[3]) {
-    // Checksum error
-    return -1;
+  byte data[PACKET_SIZE];
+  unsigned long now = millis();
+  unsigned long checksumErrors = mPacketReader.getChecksumErrorCount();
+  mLastReadStatus = readSensorData(data);
+  reportChecksumErrors(checksumErrors);
+  mLastReadTime = now;
+  if (mLastReadStatus == 0) {
+    mMeasurementPending = false;
+    mLastLatency = micros() - mTriggerTime;
+    mLastReadSuccess = now;
+    mLastFrameTime = now;
+    mLastMeasuredDistance = processData(data);
+    mLastReadResult = 0; // success
+    onReading(mLastMeasuredDistance);
+  } else if (mPacketReader.getChecksumErrorCount() != checksumErrors) {
+    // The answer arrived corrupted, so there won't be another one
+    mMeasurementPending = false;
+    mLastReadResult = -1;
+  } else if (micros() - mTriggerTime >= mTriggerTimeout * 1000) {
+    mMeasurementPending = false;
+    mLastReadStatus = -4;
+    mLastReadResult = -4;
   }
+}
 
-  int distance = (data[1] << 8) + data[2];
-  if (distance < LOWER_LIMIT_MM) {
-    return LOWER_LIMIT_MM;
-  } else {
-    return distance;
+int A02YYUWviaUARTStream::readSensorData(byte* data) {
+  return mPacketReader.readPacket(mSensorUART, data);
+}
+
+int A02YYUWviaUARTStream::readLatestSensorData(byte* data, unsigned long &frameAgeUs) {
+  // Number of bytes received after the end of the newest valid packet
+  unsigned long bytesSince = 0;
+  int status = mPacketReader.readLatestPacket<LATEST_WINS_BUFFER_SIZE>(mSensorUART, data, bytesSince);
+  if (status == 0) frameAgeUs = bytesSince * BYTE_TIME_US;
+  return status;
+}
+
+// A corrupted packet read through a MULTIUART board may be down to the SPI link rather than the sensor, so let the board know
+void A02YYUWviaUARTStream::reportChecksumErrors(unsigned long checksumErrors) {
+  if (!mBoardUART) return;
+  for (unsigned long i = checksumErrors; i < mPacketReader.getChecksumErrorCount(); i++) {
+    mBoardUART->reportLinkError();
   }
+}
+
+int A02YYUWviaUARTStream::processData(const byte* data) {
+  // Note: The packet reader only hands over packets with a valid checksum
+  return PacketReader::decode(data);
 }
\ No newline at end of file
@@ -3,6 +3,10 @@
 
 #include <Arduino.h>
 
+#include "IntegerFilters.hpp"
+#include "FramedPacketReader.hpp"
+#include "MUARTSingleStream.hpp"
+
 namespace A02YYUW {
 
   /************************
@@ -15,8 +19,34 @@ namespace A02YYUW {
   static const byte PACKET_SIZE = 4;
   // The minimum distance the sensor can detect reliably in millimeters 
   static const int LOWER_LIMIT_MM = 30;
-  // The minimum time between data reads
+  // The minimum time between data reads (and the starting estimate of the time between packets)
   static const unsigned long READ_INTERVAL_MS = 100;
+  /* Gaps between packets longer than this are assumed to be missed packets
+  * and don't count towards the estimated time between packets / ms */
+  static const unsigned long MAX_FRAME_INTERVAL_MS = 500;
+  // Time for one byte to arrive from the sensor at its fixed 9600 baud (10 bits per byte) / us
+  static const unsigned long BYTE_TIME_US = 1042;
+  // Size of the buffer the latest-wins mode reads the stream through / bytes
+  static const size_t LATEST_WINS_BUFFER_SIZE = 32;
+  // How long the mode select line is held low to trigger a measurement / us
+  static const unsigned int TRIGGER_PULSE_US = 100;
+  // Default time to wait for the packet from a triggered measurement / ms
+  static const unsigned long DEFAULT_TRIGGER_TIMEOUT_MS = 150;
+  /* Time for the echo from the furthest the sensor can see (4.5m) to come
+  * back and die away, so another sensor nearby can be triggered / ms */
+  static const unsigned long ECHO_SETTLE_MS = 30;
+
+  // Turns a valid data packet into a distance / mm
+  struct DistanceDecoder {
+    static int decode(const byte *packet) {
+      int distance = (packet[1] << 8) + packet[2];
+      // Numbers lower than 30 are incorrect - 30mm is the lower bound for readings
+      return distance < LOWER_LIMIT_MM ? LOWER_LIMIT_MM : distance;
+    }
+  };
+
+  // Reads data packets from the sensor: header byte, distance high byte, distance low byte, additive checksum
+  typedef FramedPacketReader<HEADER_BYTE, PACKET_SIZE, AdditiveChecksum, DistanceDecoder> PacketReader;
 
   class A02YYUWviaUARTStream {
 
@@ -26,17 +56,23 @@ namespace A02YYUW {
      * Constructors
      *******************************/
     A02YYUWviaUARTStream(Stream* mUARTSerial, uint8_t modeSelectPin, bool processed);
+    /* For a sensor on a MULTIUART board. Stale data can then be cleared from
+    * the board itself, not just from what the stream has buffered. */
+    A02YYUWviaUARTStream(MUARTSingleStream* mUARTSerial, uint8_t modeSelectPin, bool processed);
 
     /*******************************
      * Getters / Setters
      *******************************/
     // Get the last measured distance / mm
     float getDistance();
+    // Get the last measured distance as an integer, avoiding float maths / mm
+    uint16_t getDistanceMM();
     /* Returns true if the sensor is returning processed data, otherwise its
     * returning real-time data */
     bool isProcessed();
     /* Set processed = true to get the sensor do some pre-processing to reduce
-    * noise, otherwise the sensor will return real-time data */
+    * noise, otherwise the sensor will return real-time data. This restarts
+    * the estimate of the time between packets. */
     void setProcessed(bool processed);
     /* For Debug purposes: The last time the sensor was asked to update the
     * distance reading / ms since last reset */
@@ -44,26 +80,83 @@ namespace A02YYUW {
     /* For Debug purposes: The time the last sensor reading was successful / mm
     * since reset (i.e. a full data packet was received) */
     unsigned long getLastReadSuccess();
-    /* For Debug purposes: The result of the last read request: -1 if there's a
-    * checksum error, -2 if the frame wasn't read correctly, otherwise a distance
-    * in mm */
+    /* For Debug purposes: The result of the last read request: 0 if successful,
+    * -1 if a packet arrived but failed its checksum (and no valid one did),
+    * -4 if a triggered measurement timed out */
     int getLastReadResult();
     /* Status of the last attempt at retrieving a data packet from the sensor. 0 =
-    * success, -1 if insufficient bytes available, -2 if the header byte couldn't
-    * be found despite there being at least enough bytes for a packet of data, -3
-    * if we couldn't retrieve a complete data packet. */
+    * success, -1 if no bytes were available, -2 if the bytes available didn't
+    * contain a header byte, -3 if only part of a packet has arrived so far (it's
+    * kept and completed on the next read), -4 if a triggered measurement timed
+    * out. */
     int getLastReadStatus();
     // For Debug purposes: Get the underlying data stream for this sensor
     Stream* getSensorUART();
+    /* Returns true if each read uses the newest valid packet available and
+    * discards any older ones, rather than using packets in the order they
+    * arrived */
+    bool isLatestWins();
+    /* Set latestWins = true to have each read pull everything the sensor has
+    * sent, report the newest valid packet and discard older ones, so the
+    * distance is as fresh as possible */
+    void setLatestWins(bool latestWins);
+    /* The estimated time the packet behind the last successful reading
+    * finished arriving / ms since reset */
+    unsigned long getLastFrameTime();
+    /* Returns true if the sensor only measures when asked to by
+    * requestMeasurement(), otherwise it's free-running */
+    bool isTriggered();
+    /* Set triggered = true to only take measurements when requested (the
+    * sensor must have UART controlled output). The mode select line then
+    * idles high and is pulsed low for each measurement. */
+    void setTriggered(bool triggered);
+    // Time to wait for the packet from a triggered measurement before giving up / ms
+    unsigned long getTriggerTimeout();
+    void setTriggerTimeout(unsigned long timeoutMs);
+    // Returns true if a triggered measurement has been requested and its packet hasn't arrived yet
+    bool isMeasurementPending();
+    /* Time between the last successful triggered measurement being requested
+    * and its packet being read / us */
+    unsigned long getLastLatency();
+    /* Returns true if reads are scheduled from the measured time between
+    * packets, otherwise they're READ_INTERVAL_MS after the last one */
+    bool isAdaptiveInterval();
+    void setAdaptiveInterval(bool adaptiveInterval);
+    /* Running estimate of the time between packets from the sensor (0 until
+    * there's been a gap to measure) / ms */
+    unsigned long getFrameInterval();
+    /* How long after the last packet reads start again / ms. If the interval
+    * is adaptive this is a little less than the estimated time between
+    * packets, so a packet that comes early is still read promptly and a
+    * speed up is noticed. Otherwise (or until there's an estimate) it's
+    * READ_INTERVAL_MS. */
+    unsigned long getReadInterval();
 
     /*******************************
      * Actions
      *******************************/
-    /* Reads the distance from the sensor (returns 0 if successful, -1 if there's
-    * a checksum error, -2 if the frame wasn't read correctly). If there wasn't
-    * enough data available, or this was called before the next read interval is
-    * due, then this returns 0; */
+    /* Reads the distance from the sensor (returns 0 if successful, -1 if a
+    * packet arrived but failed its checksum and no valid one did). If there
+    * wasn't enough data available, or the next packet isn't due yet (see
+    * getReadInterval()), then this returns the previous result.
+    * Partial packets are kept and completed on the next call. In triggered
+    * mode this only looks for the packet from the pending measurement (-4 if
+    * it timed out) and isn't throttled. */
     int readDistance();
+    /* Triggered mode: discard anything the sensor sent earlier (including
+    * anything still queued on a MULTIUART board) and trigger a single
+    * measurement. Call readDistance() to pick up the result. Returns false if
+    * not in triggered mode. */
+    bool requestMeasurement();
+    /* Triggered mode: trigger a single measurement and wait for its packet (up
+    * to the trigger timeout). Returns the same as readDistance(). */
+    int measure();
+
+  protected:
+
+    /* Called with each new successful reading, whichever read path it came
+    * from, e.g. so a subclass can filter it. Does nothing by default. */
+    virtual void onReading(uint16_t distanceMM) { (void) distanceMM; };
 
   private:
     /*******************************
@@ -73,7 +166,7 @@ namespace A02YYUW {
     * interface */
     uint8_t mModeSelectPin;
     // The last measured distance / mm
-    float mLastMeasuredDistance;
+    uint16_t mLastMeasuredDistance = 0;
     /* If true the sensor is set to return processed data, otherwise its returning
     * real-time data */
     bool mProcessed;
@@ -84,29 +177,67 @@ namespace A02YYUW {
     * full data packet was received) */
     unsigned long mLastReadSuccess = 0;
     /* Status of the last attempt at retrieving a data packet from the sensor. 0 =
-    * success, -1 if insufficient bytes available, -2 if the header byte couldn't
-    * be found despite there being at least enough bytes for a packet of data, -3
-    * if we couldn't retrieve a complete data packet. */
+    * success, -1 if no bytes were available, -2 if the bytes available didn't
+    * contain a header byte, -3 if only part of a packet has arrived so far. */
     int mLastReadStatus = 0;
-    /* The result of the last read request: (0 if successful, -1 if there's a
-    * checksum error, -2 if the frame wasn't read correctly). If there wasn't
-    * enough data available, or this was called before the next read interval is
-    * due, then this returns 0; */
+    // Assembles data packets from the sensor, keeping partial packets between reads
+    PacketReader mPacketReader;
+    // If true, reads use the newest valid packet available and discard older ones
+    bool mLatestWins = false;
+    /* The estimated time the packet behind the last successful reading finished
+    * arriving / ms since reset */
+    unsigned long mLastFrameTime = 0;
+    // If true, the sensor only measures when requested
+    bool mTriggered = false;
+    // Time to wait for a triggered measurement's packet / ms
+    unsigned long mTriggerTimeout = DEFAULT_TRIGGER_TIMEOUT_MS;
+    // True between a measurement being triggered and its packet arriving (or timing out)
+    bool mMeasurementPending = false;
+    // The time the pending measurement was triggered / us since reset
+    unsigned long mTriggerTime = 0;
+    // Time from the last successful triggered measurement being requested to its packet being read / us
+    unsigned long mLastLatency = 0;
+    // If true, reads are scheduled from the measured time between packets
+    bool mAdaptiveInterval = true;
+    // Running estimate of the time between packets / ms (0 until there's been a gap to measure)
+    IntegerFilters::EMAFilter<2> mFrameInterval;
+    /* The result of the last read request: (0 if successful, -1 if a packet
+    * failed its checksum, -4 if a triggered measurement timed out). If there
+    * wasn't enough data available, or this was called before the next read
+    * interval is due, then this is left as it was. */
     int mLastReadResult = 0;
     // The UART interface to the distance sensor
     Stream* mSensorUART;
+    // The same interface if it's a MULTIUART board channel (otherwise nullptr)
+    MUARTSingleStream* mBoardUART = nullptr;
 
     /*******************************
      * Actions
      *******************************/
-    /* Read data from the sensor into the data byte array supplied. 0 = success,
-    * -1 if insufficient bytes available, -2 if the header byte couldn't be found
-    * despite there being at least enough bytes for a packet of data, -3 if we
-    * couldn't retrieve a complete data packet. */
+    /* Read data from the sensor into the packet being assembled, and copy it
+    * into the data byte array supplied once a complete packet with a valid
+    * checksum has arrived (see FramedPacketReader::readPacket()). 0 = success,
+    * -1 if no bytes were available, -2 if the bytes available didn't contain a
+    * header byte, -3 if only part of a packet has arrived so far. */
     int readSensorData(byte *data);
-    /* Process the data in the byte array supplied. Returns distance in mm or a
-    * negative number if there's an error. */
+    /* Read everything available from the sensor and copy the newest packet with
+    * a valid checksum into the data byte array supplied, discarding older ones.
+    * Any partial packet at the end is kept for next time. frameAgeUs is set to
+    * how long ago the packet finished arriving (estimated from the number of
+    * bytes received after it). Same return values as readSensorData(). */
+    int readLatestSensorData(byte *data, unsigned long &frameAgeUs);
+    /* Pass any checksum failures since the count was checksumErrors on to
+    * the MULTIUART board (if the sensor is on one) as possible link errors */
+    void reportChecksumErrors(unsigned long checksumErrors);
+    // Process the valid data packet supplied. Returns distance in mm.
     int processData(const byte *data);
+    // Look for the packet from the pending triggered measurement
+    void readTriggeredDistance();
+    /* Pull the mode select line low. A sensor with UART controlled output
+    * takes one measurement on the falling edge. */
+    void startTrigger();
+    // Return the mode select line to the level for the current mode
+    void endTrigger();
 
   };
 
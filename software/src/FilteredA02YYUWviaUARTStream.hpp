@@ -0,0 +1,52 @@
+#ifndef __FILTEREDA02YYUWVIAUARTSTREAM_H_INCLUDED__
+#define __FILTEREDA02YYUWVIAUARTSTREAM_H_INCLUDED__
+
+#include <Arduino.h>
+
+#include "A02YYUWviaUARTStream.hpp"
+#include "IntegerFilters.hpp"
+
+namespace A02YYUW {
+
+  /* An A02YYUW sensor with a compile time configured integer filter applied
+   * to each new reading, e.g.
+   *
+   *   FilteredA02YYUWviaUARTStream<IntegerFilters::MedianFilter<5>> sensor(stream, 8, true);
+   *   FilteredA02YYUWviaUARTStream<IntegerFilters::EMAFilter<2>> sensor(stream, 8, true);
+   */
+  template<class Filter>
+  class FilteredA02YYUWviaUARTStream : public A02YYUWviaUARTStream {
+
+  public:
+
+    /*******************************
+     * Constructors
+     *******************************/
+    FilteredA02YYUWviaUARTStream(Stream* mUARTSerial, uint8_t modeSelectPin, bool processed)
+      : A02YYUWviaUARTStream(mUARTSerial, modeSelectPin, processed) {};
+    FilteredA02YYUWviaUARTStream(MUARTSingleStream* mUARTSerial, uint8_t modeSelectPin, bool processed)
+      : A02YYUWviaUARTStream(mUARTSerial, modeSelectPin, processed) {};
+
+    /*******************************
+     * Getters / Setters
+     *******************************/
+    // Get the filtered distance / mm
+    uint16_t getFilteredDistanceMM() {
+      return mFilter.value();
+    }
+
+  protected:
+
+    // Feed each new reading through the filter, whichever read path it came from
+    void onReading(uint16_t distanceMM) override {
+      mFilter.update(distanceMM);
+    }
+
+  private:
+    // The filter applied to each new reading
+    Filter mFilter;
+
+  };
+
+}
+#endif // __FILTEREDA02YYUWVIAUARTSTREAM_H_INCLUDED__
@@ -0,0 +1,260 @@
+#ifndef __FRAMEDPACKETREADER_H_INCLUDED__
+#define __FRAMEDPACKETREADER_H_INCLUDED__
+
+#include <Arduino.h>
+
+/* Reads fixed length packets that start with a header byte and end with a
+ * checksum from a Stream, e.g. the data packets from UART distance sensors.
+ * The packet format is set at compile time:
+ *
+ *   Header         - the byte each packet starts with
+ *   Length         - the packet size in bytes, including the header and checksum
+ *   ChecksumPolicy - a class with a static bool isValid(const byte *packet, uint8_t length)
+ *   Decoder        - a class with a static int decode(const byte *packet) that
+ *                    turns a valid packet into a (non-negative) reading
+ *
+ * e.g. FramedPacketReader<0xFF, 4, AdditiveChecksum, A02YYUWDecoder>
+ *
+ * Packets that arrive in pieces are assembled across reads, and if a
+ * checksum fails the search for the next header starts again from the byte
+ * after the bad header (and is counted, see getChecksumErrorCount()). Read
+ * functions return 0 = success, -1 if no bytes were available, -2 if the
+ * bytes available didn't contain a header byte, -3 if only part of a packet
+ * has arrived so far. */
+template<byte Header, uint8_t Length, class ChecksumPolicy, class Decoder>
+class FramedPacketReader {
+
+  static_assert(Length >= 2, "FramedPacketReader packets need at least a header and a checksum");
+
+public:
+
+  static const byte HEADER = Header;
+  static const uint8_t LENGTH = Length;
+
+  /*******************************
+   * Getters / Setters
+   *******************************/
+  // Number of bytes of the packet being assembled that have arrived so far
+  uint8_t getPartialLength() {
+    return mFrameLength;
+  }
+
+  // Number of packets (headers with a full packet after them) that have failed their checksum
+  unsigned long getChecksumErrorCount() {
+    return mChecksumErrors;
+  }
+
+  // Returns true if the packet supplied starts with the header and has a valid checksum
+  static bool isValid(const byte *packet) {
+    return packet[0] == Header && ChecksumPolicy::isValid(packet, Length);
+  }
+
+  // Decode a valid packet
+  static int decode(const byte *packet) {
+    return Decoder::decode(packet);
+  }
+
+  /* Find the first header byte in [from, end). Returns end if there isn't
+   * one. Host builds use memchr (which compares a word at a time), the AVR
+   * gets a loop unrolled to 4 bytes per pass. */
+  static const byte* findHeader(const byte *from, const byte *end) {
+#ifdef __AVR__
+    while (end - from >= 4) {
+      if (from[0] == Header) return from;
+      if (from[1] == Header) return from + 1;
+      if (from[2] == Header) return from + 2;
+      if (from[3] == Header) return from + 3;
+      from += 4;
+    }
+    while (from < end && *from != Header) from++;
+    return from;
+#else
+    const byte *found = (const byte *) memchr(from, Header, end - from);
+    return found ? found : end;
+#endif
+  }
+
+  /* Find every valid packet in a buffer in one pass, jumping from header to
+   * header and checking each candidate's checksum. The search always carries
+   * on from the byte after a candidate, even a valid one, so a misaligned run
+   * of bytes that happens to pass the checksum can't hide a real packet that
+   * starts inside it. Packet offsets are written to offsets in order. Once
+   * maxOffsets have been found, each later packet replaces the last entry, so
+   * the newest valid packet is always the last one. Returns the number of
+   * entries written. */
+  static uint8_t findValidPackets(const byte *buffer, size_t length, size_t *offsets, uint8_t maxOffsets) {
+    uint8_t found = 0;
+    if (maxOffsets == 0) return 0;
+    const byte *end = buffer + length;
+    const byte *candidate = findHeader(buffer, end);
+    while (end - candidate >= Length) {
+      if (ChecksumPolicy::isValid(candidate, Length)) {
+        if (found < maxOffsets) found++;
+        offsets[found - 1] = candidate - buffer;
+      }
+      candidate = findHeader(candidate + 1, end);
+    }
+    return found;
+  }
+
+  /*******************************
+   * Actions
+   *******************************/
+  // Throw away any partly assembled packet
+  void reset() {
+    mFrameLength = 0;
+  }
+
+  /* Read from the stream until a complete packet with a valid checksum has
+   * arrived and copy it into the packet supplied. Nothing after the packet is
+   * read, so the rest is left in the stream for next time. */
+  int readPacket(Stream *stream, byte *packet) {
+    int available = stream->available();
+    if (mFrameLength == 0 && available <= 0) return -1;
+
+    while (available > 0) {
+      if (mFrameLength == 0) {
+        /* Look for a header a packet's worth of bytes at a time, skipping
+         * anything before it. Whatever follows the header belongs to the
+         * packet, so this never reads past the end of it. */
+        size_t count = min((size_t) available, (size_t) Length);
+        count = stream->readBytes(mFrame, count);
+        if (count == 0) break;
+        available -= count;
+        const byte *header = findHeader(mFrame, mFrame + count);
+        mFrameLength = mFrame + count - header;
+        memmove(mFrame, header, mFrameLength);
+        if (mFrameLength < Length) continue;
+      } else {
+        // Then read the rest of the packet in one go
+        size_t count = min((size_t) available, (size_t) (Length - mFrameLength));
+        count = stream->readBytes(mFrame + mFrameLength, count);
+        if (count == 0) break;
+        mFrameLength += count;
+        available -= count;
+      }
+
+      if (mFrameLength == Length) {
+        if (isValid(mFrame)) {
+          memcpy(packet, mFrame, Length);
+          mFrameLength = 0;
+          return 0;
+        }
+        mChecksumErrors++;
+        resynchronise(mFrame, mFrameLength);
+      }
+    }
+
+    // If we didn't find the header byte, there's nothing to finish off next time
+    if (mFrameLength == 0) return -2;
+    return -3; // Incomplete packet
+  }
+
+  /* Read everything available from the stream and copy the newest packet
+   * with a valid checksum into the packet supplied, discarding older ones.
+   * Any partial packet at the end is kept for next time. bytesSince is set to
+   * the number of bytes received after the packet. BufferSize is how much is
+   * read from the stream at a time. */
+  template<size_t BufferSize>
+  int readLatestPacket(Stream *stream, byte *packet, unsigned long &bytesSince) {
+    static_assert(BufferSize > Length, "FramedPacketReader buffer must be bigger than a packet");
+    byte buffer[BufferSize];
+    // Start with whatever partial packet was left over from last time
+    size_t length = mFrameLength;
+    memcpy(buffer, mFrame, mFrameLength);
+    mFrameLength = 0;
+
+    bool found = false;
+    bool bytesRead = false;
+    bool rejected = false;
+    bytesSince = 0;
+
+    int available = stream->available();
+    while (available > 0) {
+      size_t count = min((size_t) available, BufferSize - length);
+      count = stream->readBytes(buffer + length, count);
+      if (count == 0) break;
+      length += count;
+      bytesSince += count;
+      bytesRead = true;
+
+      // Find the valid packets in what's been read and keep the newest
+      size_t offsets[BufferSize / Length];
+      uint8_t packets = findValidPackets(buffer, length, offsets, BufferSize / Length);
+      size_t keepFrom = 0;
+      if (packets > 0) {
+        size_t newest = offsets[packets - 1];
+        memcpy(packet, buffer + newest, Length);
+        found = true;
+        keepFrom = newest + Length;
+        bytesSince = length - keepFrom;
+      } else if (length >= Length && findHeader(buffer, buffer + length - Length + 1) != buffer + length - Length + 1) {
+        // There was a whole packet's worth after a header, but it failed its checksum
+        rejected = true;
+      }
+      // Only the last few bytes can be the start of a packet that's still arriving
+      if (length - keepFrom > Length - 1) keepFrom = length - (Length - 1);
+      memmove(buffer, buffer + keepFrom, length - keepFrom);
+      length -= keepFrom;
+
+      available = stream->available();
+    }
+
+    // Keep any partial packet for next time
+    const byte *start = findHeader(buffer, buffer + length);
+    mFrameLength = buffer + length - start;
+    memcpy(mFrame, start, mFrameLength);
+
+    if (found) return 0;
+    if (rejected) mChecksumErrors++;
+    if (!bytesRead && mFrameLength == 0) return -1;
+    return mFrameLength == 0 ? -2 : -3;
+  }
+
+private:
+
+  /*******************************
+   * Member variables
+   *******************************/
+  /* The packet being assembled. Bytes are kept here between reads so that a
+   * packet split across reads isn't lost. */
+  byte mFrame[Length];
+  // Number of bytes of the packet assembled so far
+  uint8_t mFrameLength = 0;
+  // Number of packets that have failed their checksum
+  unsigned long mChecksumErrors = 0;
+
+  /*******************************
+   * Private functions
+   *******************************/
+  // A bad checksum means that probably wasn't really a header, so start again from the next header byte in the frame
+  static void resynchronise(byte *frame, uint8_t &frameLength) {
+    const byte *next = findHeader(frame + 1, frame + frameLength);
+    frameLength = frame + frameLength - next;
+    memmove(frame, next, frameLength);
+  }
+
+};
+
+/*******************************
+ * Checksum policies
+ *******************************/
+// The last byte is the low byte of the sum of all the others
+struct AdditiveChecksum {
+  static bool isValid(const byte *packet, uint8_t length) {
+    byte sum = 0;
+    for (uint8_t i = 0; i < length - 1; i++) sum += packet[i];
+    return sum == packet[length - 1];
+  }
+};
+
+// The last byte is all the others XORed together
+struct XorChecksum {
+  static bool isValid(const byte *packet, uint8_t length) {
+    byte sum = 0;
+    for (uint8_t i = 0; i < length - 1; i++) sum ^= packet[i];
+    return sum == packet[length - 1];
+  }
+};
+
+#endif // __FRAMEDPACKETREADER_H_INCLUDED__
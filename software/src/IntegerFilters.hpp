@@ -0,0 +1,104 @@
+#ifndef __INTEGERFILTERS_H_INCLUDED__
+#define __INTEGERFILTERS_H_INCLUDED__
+
+#include <Arduino.h>
+
+/* Integer filters for sensor readings, configured at compile time so they
+ * avoid float maths (every float operation is a library call on the AVR).
+ * Each filter has the same interface: update() takes a new sample and
+ * returns the filtered value, value() returns the last filtered value. */
+namespace IntegerFilters {
+
+  // Passes samples straight through
+  class NoFilter {
+  public:
+    uint16_t update(uint16_t sample) {
+      mValue = sample;
+      return mValue;
+    }
+    uint16_t value() {
+      return mValue;
+    }
+  private:
+    uint16_t mValue = 0;
+  };
+
+  // Median of the last N samples - good at throwing away one-off spikes
+  template<uint8_t N>
+  class MedianFilter {
+    static_assert(N > 0, "MedianFilter needs at least one sample");
+  public:
+    uint16_t update(uint16_t sample) {
+      mSamples[mNext] = sample;
+      mNext = (mNext + 1) % N;
+      if (mCount < N) mCount++;
+
+      // Insertion sort a copy - N is small so this is cheaper than anything clever
+      uint16_t sorted[N];
+      for (uint8_t i = 0; i < mCount; i++) {
+        uint16_t value = mSamples[i];
+        uint8_t j = i;
+        while (j > 0 && sorted[j - 1] > value) {
+          sorted[j] = sorted[j - 1];
+          j--;
+        }
+        sorted[j] = value;
+      }
+      mValue = sorted[mCount / 2];
+      return mValue;
+    }
+    uint16_t value() {
+      return mValue;
+    }
+  private:
+    uint16_t mSamples[N];
+    uint8_t mNext = 0;
+    uint8_t mCount = 0;
+    uint16_t mValue = 0;
+  };
+
+  /* Exponential moving average with alpha = 1 / 2^Shift, using shifts rather
+   * than multiplication. The average is held with Shift extra fractional bits
+   * so small changes aren't lost to rounding. */
+  template<uint8_t Shift>
+  class EMAFilter {
+    static_assert(Shift < 16, "EMAFilter shift is too large");
+  public:
+    uint16_t update(uint16_t sample) {
+      if (!mPrimed) {
+        // Start from the first sample rather than slowly climbing from zero
+        mAccumulator = (uint32_t) sample << Shift;
+        mPrimed = true;
+      } else {
+        // avg += (sample - avg) / 2^Shift, scaled up by 2^Shift
+        mAccumulator -= mAccumulator >> Shift;
+        mAccumulator += sample;
+      }
+      return value();
+    }
+    uint16_t value() {
+      return mAccumulator >> Shift;
+    }
+  private:
+    uint32_t mAccumulator = 0;
+    bool mPrimed = false;
+  };
+
+  // Feeds samples through First and then Second, e.g. a median to remove spikes followed by an EMA to smooth
+  template<class First, class Second>
+  class FilterChain {
+  public:
+    uint16_t update(uint16_t sample) {
+      return mSecond.update(mFirst.update(sample));
+    }
+    uint16_t value() {
+      return mSecond.value();
+    }
+  private:
+    First mFirst;
+    Second mSecond;
+  };
+
+}
+
+#endif // __INTEGERFILTERS_H_INCLUDED__
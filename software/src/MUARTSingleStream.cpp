@@ -1,11 +1,19 @@
 #include "MUARTSingleStream.hpp"
 
+// The baud rate for each MULTIUART baud rate code
+static const unsigned long BAUD_RATES[] = {1200, 2400, 4800, 9600, 19200, 38400, 57600, 115200};
+
 /*******************************
  * Constructors
  *******************************/
 MUARTSingleStream::MUARTSingleStream(MULTIUART* multiUARTInstance, char intUARTIndex) {
   mIntUARTIndex = intUARTIndex;
   mMultiUARTInstance = multiUARTInstance;
+  mMultiUARTInstance->attachStream(this);
+}
+
+MUARTSingleStream::~MUARTSingleStream() {
+  mMultiUARTInstance->detachStream(this);
 }
 
 /*******************************
@@ -21,6 +29,46 @@ char MUARTSingleStream::getIntUARTIndex() {
   return mIntUARTIndex;
 }
 
+// Set how long after the last write staged transmit data is sent by flushIfIdle() / ms
+void MUARTSingleStream::setTxIdleFlushTime(unsigned long idleFlushMs) {
+  mTxIdleFlushMs = idleFlushMs;
+}
+
+// Returns true if writes never wait for space in the MULTIUART board's transmit queue
+bool MUARTSingleStream::isNonBlockingWrite() {
+  return mNonBlockingWrite;
+}
+
+// Set nonBlocking = true to have writes only accept what the board's transmit queue has room for
+void MUARTSingleStream::setNonBlockingWrite(bool nonBlocking) {
+  mNonBlockingWrite = nonBlocking;
+}
+
+// Get the baud rate set by begin() (0 if it hasn't been called)
+unsigned long MUARTSingleStream::getBaud() {
+  return mBaud;
+}
+
+// Set how many bytes the reader wants at a time, used to predict when it's worth polling the board
+void MUARTSingleStream::setExpectedBytes(size_t expectedBytes) {
+  mExpectedBytes = expectedBytes > 0 ? expectedBytes : 1;
+}
+
+// Returns true if enough time has passed since the last poll for the expected bytes to have arrived
+bool MUARTSingleStream::isPollDue() {
+  return mBaud == 0 || micros() - mLastPollMicros >= mPollWaitMicros;
+}
+
+// Returns true if reads fetch more data from the MULTIUART board when the receive buffer runs low
+bool MUARTSingleStream::isAutoRefill() {
+  return mAutoRefill;
+}
+
+// Set autoRefill = false if MULTIUART::serviceAll() is keeping the receive buffer topped up
+void MUARTSingleStream::setAutoRefill(bool autoRefill) {
+  mAutoRefill = autoRefill;
+}
+
 /*******************************
  * Actions
  *******************************/
@@ -61,6 +109,25 @@ void MUARTSingleStream::begin(unsigned long baud) {
   }
 
   mMultiUARTInstance->SetBaud(mIntUARTIndex, baudCode);
+  mBaud = BAUD_RATES[(uint8_t) baudCode];
+
+  /* Whatever the board received before now is stale, but draining it here
+   * would wait for the board to finish writing the baud rate to flash. Leave
+   * it until the first read or transmit so several channels can be set up
+   * back to back. */
+  mRxStart = mRxEnd = 0;
+  mDrainPending = true;
+}
+
+size_t MUARTSingleStream::drain(size_t keepNewest) {
+  size_t discarded = mRxEnd - mRxStart;
+  mRxStart = mRxEnd = 0;
+  mDrainPending = false;
+  return discarded + mMultiUARTInstance->discardRx(mIntUARTIndex, keepNewest);
+}
+
+void MUARTSingleStream::reportLinkError() {
+  mMultiUARTInstance->reportLinkError();
 }
 
 uint8_t MUARTSingleStream::checkRx() {
@@ -75,41 +142,198 @@ uint8_t MUARTSingleStream::receiveByte() {
   return mMultiUARTInstance->ReceiveByte(mIntUARTIndex);
 }
 
-void MUARTSingleStream::receiveString(char *RETVAL, size_t length) {
-  mMultiUARTInstance->ReceiveString(RETVAL, mIntUARTIndex, length);
+size_t MUARTSingleStream::receiveString(char *RETVAL, size_t length) {
+  return mMultiUARTInstance->ReceiveString(RETVAL, mIntUARTIndex, length);
 }
 
 void MUARTSingleStream::transmitByte(uint8_t DATA) {
   mMultiUARTInstance->transmitByte(mIntUARTIndex, DATA);
 }
 
-void MUARTSingleStream::transmitBytes(const uint8_t *buffer, size_t length) {
-  mMultiUARTInstance->transmitBytes(mIntUARTIndex, buffer, length);
+size_t MUARTSingleStream::transmitBytes(const uint8_t *buffer, size_t length) {
+  return mMultiUARTInstance->transmitBytes(mIntUARTIndex, buffer, length);
+}
+
+int MUARTSingleStream::refill() {
+  if (mDrainPending) drain();
+  size_t buffered = mRxEnd - mRxStart;
+  size_t space = MUART_RX_BUFFER_SIZE - buffered;
+  if (space == 0) return buffered;
+
+  // Shuffle any unread data down to the start of the buffer so the new data can be read in one go
+  if (mRxStart > 0) {
+    memmove(mRxBuffer, mRxBuffer + mRxStart, buffered);
+    mRxStart = 0;
+    mRxEnd = buffered;
+  }
+
+  // Note: This only reads as much as the board has queued
+  mRxEnd += mMultiUARTInstance->readBytes(mRxBuffer + mRxEnd, mIntUARTIndex, space);
+  updatePollPrediction();
+  return mRxEnd - mRxStart;
+}
+
+size_t MUARTSingleStream::receiveQueued(size_t queued) {
+  if (mDrainPending) {
+    // Everything queued so far arrived before begin() so throw it away
+    mDrainPending = false;
+    size_t discarded = mMultiUARTInstance->readQueuedBytes(nullptr, mIntUARTIndex, queued);
+    updatePollPrediction();
+    return discarded;
+  }
+  size_t buffered = mRxEnd - mRxStart;
+  size_t space = MUART_RX_BUFFER_SIZE - buffered;
+  if (queued > space) queued = space;
+  if (queued == 0) {
+    updatePollPrediction();
+    return 0;
+  }
+
+  if (mRxStart > 0) {
+    memmove(mRxBuffer, mRxBuffer + mRxStart, buffered);
+    mRxStart = 0;
+    mRxEnd = buffered;
+  }
+
+  size_t count = mMultiUARTInstance->readQueuedBytes(mRxBuffer + mRxEnd, mIntUARTIndex, queued);
+  mRxEnd += count;
+  updatePollPrediction();
+  return count;
+}
+
+int MUARTSingleStream::topUp() {
+  size_t buffered = mRxEnd - mRxStart;
+  // Don't bother the board if there's already enough to read, or if the rest can't have arrived yet
+  if (!mAutoRefill || buffered >= mExpectedBytes || !isPollDue()) return buffered;
+  return refill();
+}
+
+void MUARTSingleStream::updatePollPrediction() {
+  size_t buffered = mRxEnd - mRxStart;
+  mLastPollMicros = micros();
+  if (mBaud == 0 || buffered >= mExpectedBytes) {
+    mPollWaitMicros = 0;
+  } else {
+    // Each byte takes 10 bits on the wire (start + 8 data + stop)
+    mPollWaitMicros = (mExpectedBytes - buffered) * (10000000UL / mBaud);
+  }
 }
 
 int MUARTSingleStream::read() {
-  return receiveByte();
+  if (mRxStart == mRxEnd && topUp() == 0) return -1;
+  uint8_t data = mRxBuffer[mRxStart++];
+  // Reset to the start of the buffer when it's empty so the next refill doesn't have to shuffle data around
+  if (mRxStart == mRxEnd) mRxStart = mRxEnd = 0;
+  return data;
+}
+
+int MUARTSingleStream::peek() {
+  if (mRxStart == mRxEnd && topUp() == 0) return -1;
+  return mRxBuffer[mRxStart];
 }
 
 int MUARTSingleStream::available() {
-  return checkRx();
+  return topUp();
 }
 
-void MUARTSingleStream::readBytes(uint8_t *buffer, size_t length) {
-  mMultiUARTInstance->readBytes(buffer, mIntUARTIndex, length);
+size_t MUARTSingleStream::readBytes(uint8_t *buffer, size_t length) {
+  size_t count = 0;
+  while (count < length) {
+    if (mRxStart == mRxEnd && topUp() == 0) break;
+    size_t chunk = min(length - count, mRxEnd - mRxStart);
+    memcpy(buffer + count, mRxBuffer + mRxStart, chunk);
+    mRxStart += chunk;
+    count += chunk;
+  }
+  if (mRxStart == mRxEnd) mRxStart = mRxEnd = 0;
+  return count;
 }
 
-// Write a byte to the stream
+// Write a byte to the stream (staged until the buffer fills or it's flushed)
 size_t MUARTSingleStream::write(uint8_t data) {
-  transmitByte(data);
-  return 1;
+  return write(&data, 1);
 }
 
-// Write a number of bytes to the stream
+// Write a number of bytes to the stream (staged until the buffer fills or it's flushed)
 size_t MUARTSingleStream::write(const uint8_t *buffer, size_t size) {
-  transmitBytes(buffer, size);
+  // In non-blocking mode, only accept what the board will definitely have room for when it's flushed
+  if (mNonBlockingWrite) {
+    int space = availableForWrite();
+    if (size > (size_t) space) size = space;
+    if (size == 0) return 0;
+  }
+
+  mLastWriteTime = millis();
+  if (mTxCount + size > MUART_TX_BUFFER_SIZE) {
+    flush();
+    // No point copying anything that would fill the staging buffer on its own
+    if (mTxCount == 0 && size >= MUART_TX_BUFFER_SIZE) {
+      return sendToModule(buffer, size, !mNonBlockingWrite);
+    }
+    // If the flush timed out, only accept what still fits
+    if (mTxCount + size > MUART_TX_BUFFER_SIZE) size = MUART_TX_BUFFER_SIZE - mTxCount;
+    if (size == 0) return 0;
+  }
+  memcpy(mTxBuffer + mTxCount, buffer, size);
+  mTxCount += size;
+  if (mTxCount == MUART_TX_BUFFER_SIZE) flush();
   return size;
 }
 
+void MUARTSingleStream::flush() {
+  if (mTxCount == 0) return;
+  // Note: In non-blocking mode the staged bytes were only accepted if there was room for them
+  size_t sent = sendToModule(mTxBuffer, mTxCount, true);
+  // Anything the board didn't take before the timeout stays staged for next time
+  memmove(mTxBuffer, mTxBuffer + sent, mTxCount - sent);
+  mTxCount -= sent;
+}
+
+size_t MUARTSingleStream::sendStaged(size_t maxBytes) {
+  size_t sent = sendToModule(mTxBuffer, min(mTxCount, maxBytes), false);
+  if (sent > 0) {
+    memmove(mTxBuffer, mTxBuffer + sent, mTxCount - sent);
+    mTxCount -= sent;
+  }
+  return sent;
+}
+
+void MUARTSingleStream::flushIfIdle() {
+  if (mTxCount > 0 && millis() - mLastWriteTime >= mTxIdleFlushMs) flush();
+}
 
+int MUARTSingleStream::availableForWrite() {
+  size_t space = moduleTxSpace(MUART_TX_BUFFER_SIZE + mTxCount);
+  return space > mTxCount ? space - mTxCount : 0;
+}
 
+size_t MUARTSingleStream::moduleTxSpace(size_t wanted) {
+  if (MULTIUART_TX_QUEUE_SIZE - mModuleTxQueued < wanted) {
+    // Note: checkTx() returns a char which is signed on the AVR so cast it back to the full byte count
+    mModuleTxQueued = (uint8_t) checkTx();
+    if (mModuleTxQueued > MULTIUART_TX_QUEUE_SIZE) mModuleTxQueued = MULTIUART_TX_QUEUE_SIZE;
+  }
+  return MULTIUART_TX_QUEUE_SIZE - mModuleTxQueued;
+}
+
+size_t MUARTSingleStream::sendToModule(const uint8_t *buffer, size_t size, bool wait) {
+  // Anything received after this could be the reply, so the stale data has to go before the first transmit
+  if (mDrainPending && size > 0) drain();
+  size_t sent = 0;
+  unsigned long waitStart = millis();
+  while (sent < size) {
+    size_t chunk = min(size - sent, moduleTxSpace(size - sent));
+    if (chunk == 0) {
+      // Give up after the stream timeout - a missing board reads as a full queue forever
+      if (!wait || millis() - waitStart >= getTimeout()) break;
+      // Let the board drain some of its queue before asking again
+      delayMicroseconds(100);
+      continue;
+    }
+    chunk = transmitBytes(buffer + sent, chunk);
+    if (chunk == 0) break;
+    mModuleTxQueued += chunk;
+    sent += chunk;
+  }
+  return sent;
+}
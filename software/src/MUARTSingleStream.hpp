@@ -5,7 +5,20 @@
 
 #include "MULTIUART.hpp"
 
-class MUARTSingleStream : public Stream {
+// Size of the software receive buffer held by each stream / bytes. Override with a build flag if needed.
+#ifndef MUART_RX_BUFFER_SIZE
+#define MUART_RX_BUFFER_SIZE 64
+#endif
+
+// Size of the software transmit staging buffer held by each stream / bytes (max 255)
+#ifndef MUART_TX_BUFFER_SIZE
+#define MUART_TX_BUFFER_SIZE 32
+#endif
+
+// Default time after the last write before staged data is sent by flushIfIdle() / ms
+static const unsigned long MUART_DEFAULT_TX_IDLE_FLUSH_MS = 5;
+
+class MUARTSingleStream : public Stream, public MULTIUARTChannel {
 
 public:
 
@@ -13,6 +26,7 @@ public:
    * Constructors
    *******************************/
   MUARTSingleStream(MULTIUART* multiUARTInstance, char intUARTIndex);
+  ~MUARTSingleStream();
 
   /*******************************
    * Getters / Setters
@@ -20,39 +34,93 @@ public:
   // For Debug purposes: Get the underlying MultiUART instance that this is abstracting from
   MULTIUART* getMultiUARTInstance();
   // Get the MultiUART UART Index number that this instance abstracts
-  char getIntUARTIndex();
+  char getIntUARTIndex() override;
+  // Set how long after the last write staged transmit data is sent by flushIfIdle() / ms
+  void setTxIdleFlushTime(unsigned long idleFlushMs);
+  /* Returns true if writes never wait for space in the MULTIUART board's
+   * transmit queue (writes may then accept fewer bytes than requested) */
+  bool isNonBlockingWrite();
+  /* Set nonBlocking = true to have writes only accept what the MULTIUART
+   * board's transmit queue has room for and return the partial count,
+   * otherwise writes wait until the board has room for all the data */
+  void setNonBlockingWrite(bool nonBlocking);
+  // Get the baud rate set by begin() (0 if it hasn't been called)
+  unsigned long getBaud();
+  /* Set how many bytes the reader wants at a time (e.g. a packet size). Reads
+   * only poll the MULTIUART board when fewer than this are buffered and enough
+   * time has passed at the baud rate for the rest to have arrived. */
+  void setExpectedBytes(size_t expectedBytes);
+  // Returns true if enough time has passed since the last poll for the expected bytes to have arrived
+  bool isPollDue() override;
+  // Returns true if reads fetch more data from the MULTIUART board when the receive buffer runs low
+  bool isAutoRefill();
+  /* Set autoRefill = false if MULTIUART::serviceAll() is being used to keep
+   * the receive buffer topped up, so that reads only ever use buffered data
+   * and never start SPI transactions of their own */
+  void setAutoRefill(bool autoRefill);
 
   /*******************************
    * Actions
    *******************************/
+  /* Set the baud rate. Any stale data queued on the MULTIUART board is thrown
+   * away by the first read, transmit or serviceAll() afterwards, so that
+   * begin() doesn't wait for the board to store the new baud rate. A reply to
+   * the first transmit is never mistaken for stale data. */
   void begin(unsigned long baud);
+  /* Throws away all received data, both in the receive buffer and queued on
+   * the MULTIUART board, apart from the newest keepNewest bytes queued on the
+   * board. Useful for getting rid of a backlog of stale data after a stall.
+   * Returns the number of bytes discarded. */
+  size_t drain(size_t keepNewest = 0);
+  /* Report data read from this stream that failed an integrity check, e.g. a
+   * bad packet checksum, as a possible SPI link error (see
+   * MULTIUART::reportLinkError()) */
+  void reportLinkError();
+  /* Tops up the receive buffer with everything the MULTIUART board has queued
+   * for this UART (up to the free space in the buffer) using a single bulk read.
+   * Returns the number of bytes now held in the receive buffer. */
+  int refill();
+  /* Sends any staged transmit data if nothing has been written for the idle
+   * flush time. Call this regularly (e.g. once per loop) so that partial
+   * writes don't sit in the staging buffer. */
+  void flushIfIdle();
+  /* Reads queued bytes (as already reported by checkRx()) from the MULTIUART
+   * board into the receive buffer without asking the board again. Reads no
+   * more than will fit. Returns the number of bytes read (the first call
+   * after begin() reads them all and throws them away as stale). */
+  size_t receiveQueued(size_t queued) override;
+  /* Sends up to maxBytes of staged transmit data, but only as much as the
+   * MULTIUART board has room for (never waits). Returns the number of bytes sent. */
+  size_t sendStaged(size_t maxBytes) override;
+
+  // Direct access to the MULTIUART board. Note: These bypass the receive buffer.
   uint8_t checkRx();
   char checkTx();
   uint8_t receiveByte();
-  void receiveString(char *RETVAL, size_t length);
+  size_t receiveString(char *RETVAL, size_t length);
   void transmitByte(uint8_t DATA);
-  void transmitBytes(const uint8_t *buffer, size_t length);
+  size_t transmitBytes(const uint8_t *buffer, size_t length);
 
   /* Stream class virtual function implementations */
   // Read a single character from the stream
   int read();
-  // Read a specified number of bytes in to buffer
-  void readBytes(uint8_t *buffer, size_t length);
-  // How many characters are available to read
+  // Read up to a specified number of bytes in to buffer, returns the number of bytes read
+  size_t readBytes(uint8_t *buffer, size_t length);
+  /* How many characters are available to read. Only polls the MULTIUART board
+   * if it's predicted to have the expected bytes (see setExpectedBytes()). */
   int available();
+  // Look at the next character in the stream without removing it (-1 if there isn't one)
+  int peek();
   // Write a byte to the stream, returns number of bytes transmitted
   size_t write(uint8_t);
   // Write a number of bytes to the stream, returns number of bytes transmitted
   size_t write(const uint8_t *buffer, size_t size);
-
-  // NOTE: THERE IS NO PEEK SUPPORT. THIS ALSO INVALIDATES ALL PARSE FUNCTIONS IN THE Stream CLASS.
-  int peek() {return 0;};
-  int timedPeek() {return -1;};
-  int peekNextDigit(LookaheadMode lookahead, bool detectDecimal) {return -1;};
-  long parseInt(LookaheadMode lookahead, char ignore) {return 0;};
-  float parseFloat(LookaheadMode lookahead, char ignore) {return 0;};
-  long parseInt(char ignore) {return 0;}
-  float parseFloat(char ignore) {return 0;}
+  /* Send any staged transmit data to the MULTIUART board now. Waits for room
+   * on the board for up to the stream timeout (see setTimeout()); anything
+   * still not sent stays staged and writes then return short counts. */
+  void flush();
+  // How many bytes can be written without waiting for the MULTIUART board's transmit queue to drain
+  int availableForWrite();
 
 private:
 
@@ -60,6 +128,58 @@ private:
   char mIntUARTIndex;
   // The instance of the MultiUART board that this UART interface is on
   MULTIUART* mMultiUARTInstance;
+  /* Bytes received from the MULTIUART board but not yet read. Unread data
+   * occupies mRxBuffer[mRxStart] to mRxBuffer[mRxEnd - 1]. */
+  uint8_t mRxBuffer[MUART_RX_BUFFER_SIZE];
+  // Index of the next unread byte in the receive buffer
+  size_t mRxStart = 0;
+  // Index one past the last unread byte in the receive buffer
+  size_t mRxEnd = 0;
+  /* Bytes written to the stream but not yet sent to the MULTIUART board. They
+   * are sent in one transaction when the buffer fills, on flush(), or by
+   * flushIfIdle() once writes have stopped for mTxIdleFlushMs. */
+  uint8_t mTxBuffer[MUART_TX_BUFFER_SIZE];
+  // Number of bytes staged in the transmit buffer
+  size_t mTxCount = 0;
+  // The time of the last write to the stream / ms since reset
+  unsigned long mLastWriteTime = 0;
+  // How long after the last write staged transmit data is sent by flushIfIdle() / ms
+  unsigned long mTxIdleFlushMs = MUART_DEFAULT_TX_IDLE_FLUSH_MS;
+  /* The number of bytes believed to be in the MULTIUART board's transmit
+   * queue. Refreshed from checkTx() only when it looks like there might not be
+   * enough room, and otherwise increased as bytes are sent (the board drains
+   * the queue over time so this never underestimates). */
+  size_t mModuleTxQueued = 0;
+  // If true, writes only accept what fits in the board's transmit queue rather than waiting for room
+  bool mNonBlockingWrite = false;
+  // If true, reads fetch more data from the board when the receive buffer runs low
+  bool mAutoRefill = true;
+  // The baud rate set by begin() (0 if it hasn't been called, which turns off poll prediction)
+  unsigned long mBaud = 0;
+  // How many bytes the reader wants at a time
+  size_t mExpectedBytes = 1;
+  // When the board was last polled for received data / us since reset
+  unsigned long mLastPollMicros = 0;
+  // How long after the last poll the expected bytes could have arrived / us
+  unsigned long mPollWaitMicros = 0;
+  // True if begin() has been called and the stale data on the board hasn't been thrown away yet
+  bool mDrainPending = false;
+
+  /*******************************
+   * Private functions
+   *******************************/
+  /* Room left in the MULTIUART board's transmit queue / bytes. Only asks the
+   * board (using checkTx()) if the cached value is less than wanted. */
+  size_t moduleTxSpace(size_t wanted);
+  /* Sends data to the MULTIUART board without overrunning its transmit queue.
+   * If wait is true this waits for room for all of it (for up to the stream
+   * timeout), otherwise it only sends what fits. Returns the number of bytes
+   * sent. */
+  size_t sendToModule(const uint8_t *buffer, size_t size, bool wait);
+  // Refills the receive buffer if auto refill is on, returns the number of bytes buffered
+  int topUp();
+  // Works out when the board is next worth polling, having just polled it
+  void updatePollPrediction();
 
 };
 
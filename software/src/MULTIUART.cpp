@@ -11,8 +11,16 @@ Uses a single SPI bus to control up to four buffered hardware UART channels
 
 #include "MULTIUART.hpp"
 
+#include <EEPROM.h>
+
+// The SPI clock dividers from fastest to slowest
+static const uint8_t SPI_DIVIDERS[] = {SPI_CLOCK_DIV2, SPI_CLOCK_DIV4, SPI_CLOCK_DIV8, SPI_CLOCK_DIV16, SPI_CLOCK_DIV32, SPI_CLOCK_DIV64, SPI_CLOCK_DIV128};
+static const uint8_t SPI_DIVIDER_COUNT = sizeof(SPI_DIVIDERS) / sizeof(SPI_DIVIDERS[0]);
+
 MULTIUART::MULTIUART(uint8_t ss)
 {
+  // Make sure the board starts deselected - it may be sharing the SPI bus with other boards
+  digitalWrite(ss, HIGH);
   pinMode(ss, OUTPUT);
   _ss_pin = ss;
 }
@@ -25,7 +33,105 @@ void MULTIUART::initialise(int SPIDivider)
 {
 	SPI.begin();
 	SPI.setBitOrder(MSBFIRST);
+	setClockDivider(SPIDivider);
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Changes the SPI clock divider (one of the SPI_CLOCK_DIVx values).
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::setClockDivider(int SPIDivider)
+{
 	SPI.setClockDivider(SPIDivider);
+	_divider_index = SPI_DIVIDER_COUNT - 1;
+	for (uint8_t i = 0; i < SPI_DIVIDER_COUNT; i++)
+	{
+		if (SPI_DIVIDERS[i] == SPIDivider) _divider_index = i;
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Returns the SPI clock divider in use (one of the SPI_CLOCK_DIVx values).
+\*=----------------------------------------------------------------------=*/
+int MULTIUART::getClockDivider()
+{
+	return SPI_DIVIDERS[_divider_index];
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Returns the number of signs of a corrupted SPI link, i.e. failed
+       :checks while auto tuning plus anything passed to reportLinkError().
+\*=----------------------------------------------------------------------=*/
+unsigned long MULTIUART::getLinkErrorCount()
+{
+	return _link_errors;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Finds the fastest SPI clock the board reliably works at.
+       :Needs a UART with its TX wired to its RX: a stuck or floating MISO
+       :line reads back as plausible queue depths, so only data that makes
+       :the round trip proves a clock works. Steps through the dividers from
+       :fastest to slowest, checking each with repeated CheckRx / CheckTx
+       :reads (answers must be consistent with each other) and loopback
+       :writes. Settles marginSteps slower than the fastest clock that passes.
+       :From then on, if link errors are reported the link is checked again
+       :the same way and the clock only slows down if it fails.
+       :If no clock passes (e.g. nothing is looped back) the clock is left
+       :as it was.
+       :Parameters:
+       :  loopbackUART : UART Index Range: 0-3, with its TX wired to its RX
+       :  marginSteps : Number of dividers slower than the fastest reliable one to use
+       :Returns : The SPI clock divider in use afterwards
+\*=----------------------------------------------------------------------=*/
+int MULTIUART::autoTuneClock(char loopbackUART, uint8_t marginSteps)
+{
+	if (loopbackUART < 0 || loopbackUART >= 4) return getClockDivider();
+
+	uint8_t original = _divider_index;
+	bool found = false;
+	uint8_t chosen = original;
+	_tuning = true;
+	for (uint8_t i = 0; i < SPI_DIVIDER_COUNT && !found; i++)
+	{
+		setClockDivider(SPI_DIVIDERS[i]);
+		if (validateLink(loopbackUART))
+		{
+			chosen = min(i + marginSteps, SPI_DIVIDER_COUNT - 1);
+			found = true;
+		}
+	}
+	_tuning = false;
+
+	setClockDivider(SPI_DIVIDERS[chosen]);
+	if (found)
+	{
+		_auto_tuned = true;
+		_errors_since_tune = 0;
+		_loopback_uart = loopbackUART;
+	}
+	return SPI_DIVIDERS[chosen];
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Starts a command by asserting the chip select line.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::select()
+{
+	digitalWrite(_ss_pin, LOW);
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Ends a command by releasing the chip select line.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::deselect()
+{
+	digitalWrite(_ss_pin, HIGH);
 }
 
 
@@ -41,11 +147,12 @@ uint8_t MULTIUART::checkRx(char UART) {
 
 	if (UART < 4)
 	{
-		digitalWrite(_ss_pin, LOW);
+		waitForSettle();
+		select();
 		SPI.transfer(0x10 | UART);
 		// delayMicroseconds(250);
 		retVal = SPI.transfer(0xFF);
-		digitalWrite(_ss_pin, HIGH);
+		deselect();
 		// delayMicroseconds(50);
 	}
 
@@ -64,11 +171,12 @@ char MULTIUART::CheckTx(char UART)
 
 	if (UART < 4)
 	{
-		digitalWrite(_ss_pin, LOW);
+		waitForSettle();
+		select();
 		SPI.transfer(0x30 | UART);
 		// delayMicroseconds(250);
 		RETVAL = SPI.transfer(0xFF);
-		digitalWrite(_ss_pin, HIGH);
+		deselect();
 		// delayMicroseconds(50);
 	}
 
@@ -91,13 +199,14 @@ uint8_t MULTIUART::ReceiveByte(char UART)
 
 	if (UART < 4)
 	{
-		digitalWrite(_ss_pin, LOW);
+		waitForSettle();
+		select();
 		SPI.transfer(0x20 | UART);
 		// delayMicroseconds(50);
 		SPI.transfer(1);
 		// delayMicroseconds(50);
 		RETVAL = SPI.transfer(0xFF);
-		digitalWrite(_ss_pin, HIGH);
+		deselect();
 		// delayMicroseconds(50);
 	}
 
@@ -108,38 +217,116 @@ uint8_t MULTIUART::ReceiveByte(char UART)
 
 /*=----------------------------------------------------------------------=*\
    Use :Returns a string of received bytes held in queue for the selected channel.
-       :Recommended to use the CheckRx macro first to collect number of bytes.
+       :Reads no more than the number of bytes held in queue.
        :Parameters for macro ReceiveString:
        :  UART : UART Index Range: 0-3
        :  NumBytes : char
-       :Returns : MX_CHAR
+       :Returns : Number of bytes read (RETVAL must have room for NUMBYTES + 1)
 \*=----------------------------------------------------------------------=*/
-void MULTIUART::ReceiveString(char *RETVAL, char UART, size_t NUMBYTES) {
+size_t MULTIUART::ReceiveString(char *RETVAL, char UART, size_t NUMBYTES) {
 	// In Arduino land, uint8_t and char are the same size, so just casting one to the other.
-	readBytes((uint8_t*) RETVAL, UART, NUMBYTES);
+	size_t count = readBytes((uint8_t*) RETVAL, UART, NUMBYTES);
 	// Add C-style string terminator
-	RETVAL[NUMBYTES] = 0;
+	RETVAL[count] = 0;
+	return count;
 }
 
-void MULTIUART::readBytes(uint8_t *buffer, char UART, size_t length) {
-	
+/*=----------------------------------------------------------------------=*\
+   Use :Reads up to length received bytes held in queue for the selected channel.
+       :Never reads more than CheckRx reports and splits the read into as few
+       :transactions as the one byte length field allows.
+       :Parameters:
+       :  UART : UART Index Range: 0-3
+       :Returns : Number of bytes read
+\*=----------------------------------------------------------------------=*/
+size_t MULTIUART::readBytes(uint8_t *buffer, char UART, size_t length) {
+
+	size_t count = 0;
+
 	if (UART < 4) {
-		unsigned int index = 0;
-		digitalWrite(_ss_pin, LOW);
-		SPI.transfer(0x20 | UART);
-		// delayMicroseconds(50);
-		SPI.transfer(length);
-		// delayMicroseconds(50);
-		while ((index < length))
-		{
-			buffer[index] = SPI.transfer(0xFF);
+		while (count < length) {
+			size_t chunk = min(length - count, MULTIUART_MAX_TRANSFER);
+			// Asking for more than is queued would desynchronise the board
+			uint8_t queued = checkRx(UART);
+			if (queued < chunk) chunk = queued;
+			if (chunk == 0) break;
+
+			count += readQueuedBytes(buffer + count, UART, chunk);
+
+			// If that wasn't a full size chunk then the queue has been drained
+			if (chunk < MULTIUART_MAX_TRANSFER) break;
+		}
+	}
+
+	return count;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Reads length received bytes for the selected channel without
+       :checking how many are queued. The caller must already know (from
+       :CheckRx) that at least length bytes are queued. If buffer is
+       :nullptr the bytes are read and thrown away.
+       :Parameters:
+       :  UART : UART Index Range: 0-3
+       :Returns : Number of bytes read
+\*=----------------------------------------------------------------------=*/
+size_t MULTIUART::readQueuedBytes(uint8_t *buffer, char UART, size_t length) {
+
+	size_t count = 0;
+
+	if (UART < 4) {
+		while (count < length) {
+			size_t chunk = min(length - count, MULTIUART_MAX_TRANSFER);
+			unsigned int index = 0;
+			waitForSettle();
+			select();
+			SPI.transfer(0x20 | UART);
+			// delayMicroseconds(50);
+			SPI.transfer(chunk);
+			// delayMicroseconds(50);
+			while ((index < chunk))
+			{
+				uint8_t data = SPI.transfer(0xFF);
+				if (buffer) buffer[count + index] = data;
+				// delayMicroseconds(50);
+				index++;
+			}
+			deselect();
 			// delayMicroseconds(50);
-			index++;
+			count += chunk;
+		}
+	}
+
+	return count;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Throws away everything in the receive queue for the selected channel
+       :(apart from the newest keepNewest bytes) using as few transactions
+       :as possible.
+       :Parameters:
+       :  UART : UART Index Range: 0-3
+       :  keepNewest : Number of the most recently received bytes to leave queued
+       :Returns : Number of bytes discarded
+\*=----------------------------------------------------------------------=*/
+size_t MULTIUART::discardRx(char UART, size_t keepNewest)
+{
+	size_t count = 0;
+
+	if (UART < 4)
+	{
+		// Bytes can keep arriving while draining, so have a few goes but don't chase a busy line forever
+		for (uint8_t pass = 0; pass < MULTIUART_DRAIN_PASSES; pass++)
+		{
+			uint8_t queued = checkRx(UART);
+			if (queued <= keepNewest) break;
+			count += readQueuedBytes(nullptr, UART, queued - keepNewest);
 		}
-		digitalWrite(_ss_pin, HIGH);
-		// delayMicroseconds(50);
 	}
 
+	return count;
 }
 
 
@@ -153,13 +340,14 @@ void MULTIUART::transmitByte(char UART, const uint8_t DATA)
 {
 	if (UART < 4)
 	{
-		digitalWrite(_ss_pin, LOW);
+		waitForSettle();
+		select();
 		SPI.transfer(0x40 | UART);
 		// delayMicroseconds(50);
 		SPI.transfer(1);
 		// delayMicroseconds(50);
 		SPI.transfer(DATA);
-		digitalWrite(_ss_pin, HIGH);
+		deselect();
 		// delayMicroseconds(50);
 	}
 }
@@ -171,27 +359,38 @@ void MULTIUART::transmitByte(char UART, const uint8_t DATA)
        :Parameters for macro TransmitString:
        :  UART : UART Index Range: 0-3
        :  Data[20] : MX_CHAR (by-ref)
+       :Returns : Number of bytes queued
 \*=----------------------------------------------------------------------=*/
-void MULTIUART::transmitBytes(char UART, const uint8_t *DATA, size_t NUMBYTES)
+size_t MULTIUART::transmitBytes(char UART, const uint8_t *DATA, size_t NUMBYTES)
 {
-	unsigned int index = 0;
+	size_t count = 0;
 
 	if (UART < 4)
 	{
-		digitalWrite(_ss_pin, LOW);
-		SPI.transfer(0x40 | UART);
-		// delayMicroseconds(50);
-		SPI.transfer(NUMBYTES);
-		// delayMicroseconds(50);
-		while (index < NUMBYTES)
+		// The length is sent as one byte, so send anything longer as back to back commands
+		while (count < NUMBYTES)
 		{
-			SPI.transfer(DATA[index]);
+			size_t chunk = min(NUMBYTES - count, MULTIUART_MAX_TRANSFER);
+			unsigned int index = 0;
+			waitForSettle();
+			select();
+			SPI.transfer(0x40 | UART);
+			// delayMicroseconds(50);
+			SPI.transfer(chunk);
+			// delayMicroseconds(50);
+			while (index < chunk)
+			{
+				SPI.transfer(DATA[count + index]);
+				// delayMicroseconds(50);
+				index++;
+			}
+			deselect();
 			// delayMicroseconds(50);
-			index++;
+			count += chunk;
 		}
-		digitalWrite(_ss_pin, HIGH);
-		// delayMicroseconds(50);
 	}
+
+	return count;
 }
 
 
@@ -202,21 +401,258 @@ void MULTIUART::transmitBytes(char UART, const uint8_t *DATA, size_t NUMBYTES)
        :Parameters for macro SetBaud:
        :  UART : UART Index Range: 0-3
        :  Baud : 0=1200, 1=2400, 2=4800, 3=9600, 4=19200, 5=38400, 6=57600, 7=115200, 8=31250, 9=62500
+       :Doesn't block for the flash write - the next command waits for
+       :whatever is left of it. Skipped if the channel is already set to Baud.
 \*=----------------------------------------------------------------------=*/
 void MULTIUART::SetBaud(char UART, char BAUD)
 {
-	if (UART < 4)
+	// Note: char is signed on the AVR, so compare it unsigned to keep negative channels out of the cache
+	if ((uint8_t) UART < 4)
 	{
 		if (BAUD < 10)
 		{
-			digitalWrite(_ss_pin, LOW);
+			// The board keeps its configuration in flash, so don't wear it out rewriting the same value
+			if (_baud_codes[(uint8_t) UART] == BAUD) return;
+
+			waitForSettle();
+			select();
 			SPI.transfer(0x80 | UART);
 			// delayMicroseconds(50);
 			SPI.transfer(BAUD);
-			digitalWrite(_ss_pin, HIGH);
+			deselect();
 			// delayMicroseconds(50);
+
+			_baud_codes[(uint8_t) UART] = BAUD;
+			if (_baud_cache_address >= 0) EEPROM.update(_baud_cache_address + (uint8_t) UART, BAUD);
+
+			// Give the board 20ms for the flash erase and write before the next command (see waitForSettle)
+			_settle_start = millis();
+			_settling = true;
 		}
-		delay(20);                // waits for 20ms - time for flash erase and write
 	}
 }
 
+
+/*=----------------------------------------------------------------------=*\
+   Use :Remembers the baud rate configured for each channel in EEPROM (4
+       :bytes from eepromAddress) so that SetBaud can skip rewriting the
+       :board's flash with the same setting after a reset.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::enableBaudCache(int eepromAddress)
+{
+	_baud_cache_address = eepromAddress;
+	for (uint8_t UART = 0; UART < MULTIUART_UART_COUNT; UART++)
+	{
+		uint8_t BAUD = EEPROM.read(eepromAddress + UART);
+		// Erased EEPROM reads as 0xFF, i.e. unknown
+		_baud_codes[UART] = BAUD < 10 ? BAUD : MULTIUART_BAUD_UNKNOWN;
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Forgets the remembered baud rates, so the next SetBaud for each
+       :channel is always sent (e.g. after swapping the board).
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::clearBaudCache()
+{
+	for (uint8_t UART = 0; UART < MULTIUART_UART_COUNT; UART++)
+	{
+		_baud_codes[UART] = MULTIUART_BAUD_UNKNOWN;
+		if (_baud_cache_address >= 0) EEPROM.update(_baud_cache_address + UART, MULTIUART_BAUD_UNKNOWN);
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Returns true while the board is still writing a new baud rate to flash.
+\*=----------------------------------------------------------------------=*/
+bool MULTIUART::isSettling()
+{
+	if (_settling && millis() - _settle_start >= MULTIUART_SETTLE_MS) _settling = false;
+	return _settling;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Waits for whatever is left of the flash write time after a SetBaud.
+       :Anything done between SetBaud and the next command overlaps it.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::waitForSettle()
+{
+	while (isSettling());
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Registers the stream that abstracts one of the UARTs so that
+       :serviceAll() can keep it topped up.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::attachStream(MULTIUARTChannel *stream)
+{
+	char UART = stream->getIntUARTIndex();
+	if ((uint8_t) UART < 4) _streams[(uint8_t) UART] = stream;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Unregisters the stream that abstracts one of the UARTs.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::detachStream(MULTIUARTChannel *stream)
+{
+	char UART = stream->getIntUARTIndex();
+	if ((uint8_t) UART < 4 && _streams[(uint8_t) UART] == stream) _streams[(uint8_t) UART] = nullptr;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Sets the order serviceAll() services the selected channel in.
+       :Parameters:
+       :  UART : UART Index Range: 0-3
+       :  priority : Higher priority channels are serviced first
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::setPriority(char UART, uint8_t priority)
+{
+	if ((uint8_t) UART < 4)
+	{
+		_priorities[(uint8_t) UART] = priority;
+		sortServiceOrder();
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Services all attached streams in a single pass.
+       :Queries the receive queue of every attached channel that is due a
+       :poll (see MULTIUARTChannel::isPollDue) back to back,
+       :then (highest priority first) drains each non-empty queue into its
+       :stream with one bulk read and sends its pending transmit data.
+       :Parameters:
+       :  byteBudget : Stop moving data once this many bytes have been moved
+       :Returns : Number of bytes moved
+\*=----------------------------------------------------------------------=*/
+size_t MULTIUART::serviceAll(size_t byteBudget)
+{
+	uint8_t queued[MULTIUART_UART_COUNT] = {0, 0, 0, 0};
+	bool polled[MULTIUART_UART_COUNT] = {false, false, false, false};
+	for (uint8_t UART = 0; UART < MULTIUART_UART_COUNT; UART++)
+	{
+		// Skip streams that can't have received what they're waiting for yet
+		if (_streams[UART] && _streams[UART]->isPollDue())
+		{
+			queued[UART] = checkRx(UART);
+			polled[UART] = true;
+		}
+	}
+
+	size_t moved = 0;
+	for (uint8_t i = 0; i < MULTIUART_UART_COUNT && moved < byteBudget; i++)
+	{
+		uint8_t UART = _service_order[i];
+		MULTIUARTChannel *stream = _streams[UART];
+		if (!stream) continue;
+
+		if (polled[UART]) moved += stream->receiveQueued(min((size_t) queued[UART], byteBudget - moved));
+		if (moved < byteBudget) moved += stream->sendStaged(byteBudget - moved);
+	}
+
+	return moved;
+}
+
+
+void MULTIUART::sortServiceOrder()
+{
+	// Insertion sort - there are only four of them
+	for (uint8_t i = 1; i < MULTIUART_UART_COUNT; i++)
+	{
+		uint8_t UART = _service_order[i];
+		uint8_t j = i;
+		while (j > 0 && _priorities[_service_order[j - 1]] < _priorities[UART])
+		{
+			_service_order[j] = _service_order[j - 1];
+			j--;
+		}
+		_service_order[j] = UART;
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Checks the SPI link works at the current clock. See autoTuneClock.
+\*=----------------------------------------------------------------------=*/
+bool MULTIUART::validateLink(char loopbackUART)
+{
+	for (uint8_t round = 0; round < MULTIUART_TUNE_ROUNDS; round++)
+	{
+		for (uint8_t UART = 0; UART < MULTIUART_UART_COUNT; UART++)
+		{
+			// Nothing is reading or writing, so receive queues can only grow and transmit queues only shrink
+			uint8_t rx = checkRx(UART);
+			uint8_t tx = CheckTx(UART);
+			if (checkRx(UART) < rx || (uint8_t) CheckTx(UART) > tx)
+			{
+				reportLinkError();
+				return false;
+			}
+		}
+	}
+
+	// A different pattern each round, covering every bit in both states
+	for (uint8_t round = 0; round < MULTIUART_TUNE_LOOPBACK_ROUNDS; round++)
+	{
+		uint8_t pattern[] = {0x55, 0xAA, 0x0F, 0xF0, 0x00, 0xFF, 0xA5, round};
+		uint8_t received[sizeof(pattern)];
+
+		discardRx(loopbackUART);
+		transmitBytes(loopbackUART, pattern, sizeof(pattern));
+		unsigned long start = millis();
+		while (checkRx(loopbackUART) < sizeof(pattern))
+		{
+			if (millis() - start > MULTIUART_TUNE_LOOPBACK_TIMEOUT_MS)
+			{
+				reportLinkError();
+				return false;
+			}
+		}
+		if (readBytes(received, loopbackUART, sizeof(pattern)) != sizeof(pattern) || memcmp(received, pattern, sizeof(pattern)) != 0)
+		{
+			reportLinkError();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Records a sign of a corrupted SPI link (e.g. a checksum failure on
+       :data read through the board). After an auto tune,
+       :MULTIUART_LINK_ERROR_LIMIT of these re-check the link.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::reportLinkError()
+{
+	_link_errors++;
+	if (_auto_tuned && !_tuning && ++_errors_since_tune >= MULTIUART_LINK_ERROR_LIMIT)
+	{
+		_errors_since_tune = 0;
+		recheckLink();
+	}
+}
+
+
+/*=----------------------------------------------------------------------=*\
+   Use :Checks the link again with the loopback UART autoTuneClock() used.
+       :The errors may not be the SPI link's fault (e.g. noise on a UART
+       :line), so the clock only slows down, a step at a time, while the
+       :link fails its checks.
+\*=----------------------------------------------------------------------=*/
+void MULTIUART::recheckLink()
+{
+	_tuning = true;
+	while (!validateLink(_loopback_uart) && _divider_index < SPI_DIVIDER_COUNT - 1)
+	{
+		setClockDivider(SPI_DIVIDERS[_divider_index + 1]);
+	}
+	_tuning = false;
+}
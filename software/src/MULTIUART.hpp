@@ -17,25 +17,154 @@ Uses a single SPI bus to control up to four buffered hardware UART channels
 #include <Arduino.h>
 #include <SPI.h>
 
+/* How many bytes MUARTSingleStream lets queue up in the MULTIUART board's
+ * transmit queue for each UART / bytes. The board holds more than this (its
+ * queue depth answers go up to 255), so this is a conservative limit rather
+ * than the board's real capacity. */
+#ifndef MULTIUART_TX_QUEUE_SIZE
+#define MULTIUART_TX_QUEUE_SIZE 128
+#endif
+
+// The most bytes that can be moved in a single read or transmit command (the length is sent as one byte)
+static const size_t MULTIUART_MAX_TRANSFER = 255;
+// Number of UARTs on a MULTIUART board
+static const uint8_t MULTIUART_UART_COUNT = 4;
+// No limit on the number of bytes serviceAll() moves
+static const size_t MULTIUART_NO_BUDGET = (size_t) -1;
+// Time the board needs to write a new baud rate to flash / ms
+static const unsigned long MULTIUART_SETTLE_MS = 20;
+// Baud rate code for a channel whose configuration isn't known
+static const uint8_t MULTIUART_BAUD_UNKNOWN = 0xFF;
+// The most times discardRx() goes back for data that arrived while it was draining a queue
+static const uint8_t MULTIUART_DRAIN_PASSES = 4;
+// Number of rounds of queue checks autoTuneClock() does at each clock speed
+static const uint8_t MULTIUART_TUNE_ROUNDS = 8;
+// Number of loopback writes autoTuneClock() checks at each clock speed
+static const uint8_t MULTIUART_TUNE_LOOPBACK_ROUNDS = 4;
+// How long autoTuneClock() waits for loopback data / ms
+static const unsigned long MULTIUART_TUNE_LOOPBACK_TIMEOUT_MS = 50;
+// Number of link errors after an auto tune before the SPI clock is slowed down a step
+static const uint8_t MULTIUART_LINK_ERROR_LIMIT = 3;
+
+/* Something that buffers the data for one of the UARTs and can be kept
+ * topped up by MULTIUART::serviceAll() (e.g. MUARTSingleStream) */
+class MULTIUARTChannel {
+
+public:
+
+	// The UART Index Range: 0-3 this buffers
+	virtual char getIntUARTIndex() = 0;
+	// Returns true if it's worth asking the board how much has been received for this UART
+	virtual bool isPollDue() = 0;
+	// Reads queued bytes (as already reported by checkRx) from the board. Returns the number of bytes read.
+	virtual size_t receiveQueued(size_t queued) = 0;
+	// Sends up to maxBytes of pending transmit data to the board. Returns the number of bytes sent.
+	virtual size_t sendStaged(size_t maxBytes) = 0;
+
+};
+
 class MULTIUART {
 
 public:
 
 	MULTIUART(uint8_t ss);
 	void initialise(int SPIDivider);
+	// Change the SPI clock divider (one of the SPI_CLOCK_DIVx values)
+	void setClockDivider(int SPIDivider);
+	// Get the SPI clock divider in use
+	int getClockDivider();
+	/* Picks the fastest SPI clock the board reliably works at (less a safety
+	 * margin of marginSteps dividers) and re-checks it if link errors are
+	 * reported later. loopbackUART must have its TX wired to its RX - the
+	 * clock is only changed if data written to it reads back intact. Returns
+	 * the divider in use afterwards. */
+	int autoTuneClock(char loopbackUART, uint8_t marginSteps = 1);
+	// Number of signs of a corrupted SPI link seen (see reportLinkError())
+	unsigned long getLinkErrorCount();
+	/* Report a sign of a corrupted SPI link, e.g. a checksum failure on data
+	 * read through the board. After autoTuneClock(), too many of these
+	 * re-check the link and slow the SPI clock down until it passes. */
+	void reportLinkError();
 	uint8_t checkRx(char UART);
 	char CheckTx(char UART);
 	uint8_t ReceiveByte(char UART);
-	void ReceiveString(char *RETVAL, char UART, size_t NUMBYTES);
+	size_t ReceiveString(char *RETVAL, char UART, size_t NUMBYTES);
 	void transmitByte(char UART, const uint8_t DATA);
-	void transmitBytes(char UART, const uint8_t *DATA, size_t NUMBYTES);
+	size_t transmitBytes(char UART, const uint8_t *DATA, size_t NUMBYTES);
 	void SetBaud(char UART, char BAUD);
+	// Remember each channel's baud rate in EEPROM (4 bytes from eepromAddress) so SetBaud can skip redundant flash writes across resets
+	void enableBaudCache(int eepromAddress);
+	// Forget the remembered baud rates so the next SetBaud for each channel is always sent
+	void clearBaudCache();
+	// Returns true while the board is still writing a new baud rate to flash
+	bool isSettling();
+	// Waits until the board has finished writing a new baud rate to flash (called before every command)
+	void waitForSettle();
 
-	void readBytes(uint8_t *buffer, char UART, size_t length);
+	size_t readBytes(uint8_t *buffer, char UART, size_t length);
+	// Reads length bytes without checking how many are queued first. Only use this if CheckRx has already reported at least length bytes.
+	size_t readQueuedBytes(uint8_t *buffer, char UART, size_t length);
+	// Throws away everything queued for the UART apart from the newest keepNewest bytes. Returns the number of bytes discarded.
+	size_t discardRx(char UART, size_t keepNewest = 0);
+
+	// Registers the stream for a UART so serviceAll() can fill its receive buffer and send its pending data
+	void attachStream(MULTIUARTChannel *stream);
+	// Unregisters the stream for a UART
+	void detachStream(MULTIUARTChannel *stream);
+	// Set the order serviceAll() services the UART in. Higher priority UARTs are serviced first (default 0).
+	void setPriority(char UART, uint8_t priority);
+	/* Services every attached stream in one pass: queries the receive queue
+	 * depth of all of them, then in priority order drains each non-empty queue
+	 * into its stream with one bulk read and sends any pending transmit data.
+	 * Stops moving data once byteBudget bytes have been moved. Returns the
+	 * number of bytes moved. */
+	size_t serviceAll(size_t byteBudget = MULTIUART_NO_BUDGET);
 	
-private:
+protected:
+	// Asserts chip select to start a command. Override to change how the board is selected.
+	virtual void select();
+	// Releases chip select to end a command
+	virtual void deselect();
+
 	uint8_t _ss_pin;
 
+private:
+	// Checks the SPI link works at the current clock
+	bool validateLink(char loopbackUART);
+	// Re-checks the link after link errors, slowing the clock down until it passes
+	void recheckLink();
+
+	// Index of the SPI clock divider in use (0 = fastest)
+	uint8_t _divider_index = 0;
+	// Total number of signs of a corrupted SPI link
+	unsigned long _link_errors = 0;
+	// Number of link errors since the clock was last tuned
+	uint8_t _errors_since_tune = 0;
+	// True once autoTuneClock() has been run, enabling automatic slow down on link errors
+	bool _auto_tuned = false;
+	// True while autoTuneClock() (or a re-check) is running
+	bool _tuning = false;
+	// The UART autoTuneClock() used for loopback checks
+	char _loopback_uart = 0;
+	// The last baud rate code set on each channel (MULTIUART_BAUD_UNKNOWN if not known)
+	uint8_t _baud_codes[MULTIUART_UART_COUNT] = {MULTIUART_BAUD_UNKNOWN, MULTIUART_BAUD_UNKNOWN, MULTIUART_BAUD_UNKNOWN, MULTIUART_BAUD_UNKNOWN};
+	// EEPROM address the baud rate codes are remembered at (-1 if they aren't)
+	int _baud_cache_address = -1;
+	// True if the board may still be writing a new baud rate to flash
+	bool _settling = false;
+	// When the last baud rate change was sent / ms since reset
+	unsigned long _settle_start = 0;
+
+	// Sorts _service_order by priority
+	void sortServiceOrder();
+
+	// The stream attached to each UART (nullptr if none)
+	MULTIUARTChannel *_streams[MULTIUART_UART_COUNT] = {nullptr, nullptr, nullptr, nullptr};
+	// The service priority of each UART
+	uint8_t _priorities[MULTIUART_UART_COUNT] = {0, 0, 0, 0};
+	// The UART indices in the order serviceAll() services them
+	uint8_t _service_order[MULTIUART_UART_COUNT] = {0, 1, 2, 3};
+
 };
 
 #endif // __MULTIUART_H_INCLUDED__
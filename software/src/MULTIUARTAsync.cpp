@@ -0,0 +1,257 @@
+#include "MULTIUARTAsync.hpp"
+
+#if defined(__AVR__) && defined(MULTIUART_ASYNC_USE_ISR)
+// The instance that receives SPI transfer complete interrupts
+static MULTIUARTAsync* sActiveInstance = nullptr;
+
+ISR(SPI_STC_vect) {
+  if (sActiveInstance) sActiveInstance->onTransferComplete(SPDR);
+}
+#endif
+
+/*******************************
+ * Constructors
+ *******************************/
+MULTIUARTAsync::MULTIUARTAsync(uint8_t ss) : MULTIUART(ss) {
+#if defined(__AVR__) && defined(MULTIUART_ASYNC_USE_ISR)
+  sActiveInstance = this;
+#endif
+}
+
+/*******************************
+ * Getters / Setters
+ *******************************/
+bool MULTIUARTAsync::isBusy() {
+  return mQueueCount > 0;
+}
+
+/*******************************
+ * Actions
+ *******************************/
+bool MULTIUARTAsync::checkRxAsync(char UART, CompletionFuncPtr onComplete, void *context) {
+  return enqueue({CommandType::checkRx, UART, nullptr, nullptr, 0, 0, onComplete, context});
+}
+
+bool MULTIUARTAsync::checkTxAsync(char UART, CompletionFuncPtr onComplete, void *context) {
+  return enqueue({CommandType::checkTx, UART, nullptr, nullptr, 0, 0, onComplete, context});
+}
+
+bool MULTIUARTAsync::readBytesAsync(uint8_t *buffer, char UART, size_t length, CompletionFuncPtr onComplete, void *context) {
+  return enqueue({CommandType::readBytes, UART, buffer, nullptr, length, 0, onComplete, context});
+}
+
+bool MULTIUARTAsync::transmitBytesAsync(char UART, const uint8_t *data, size_t length, CompletionFuncPtr onComplete, void *context) {
+  return enqueue({CommandType::transmitBytes, UART, nullptr, data, length, 0, onComplete, context});
+}
+
+void MULTIUARTAsync::waitUntilIdle() {
+  while (mQueueCount > 0) poll();
+}
+
+void MULTIUARTAsync::poll() {
+#if !defined(MULTIUART_ASYNC_USE_ISR)
+  if (mQueueCount > 0 && isTransferComplete()) onTransferComplete(readSPIByte());
+#endif
+}
+
+void MULTIUARTAsync::select() {
+  /* The bus is free while a completion callback runs (the next command
+   * starts after it returns), and the queue can't drain until the callback
+   * returns, so waiting here would never finish */
+  if (!mInCallback) waitUntilIdle();
+  MULTIUART::select();
+}
+
+void MULTIUARTAsync::onTransferComplete(uint8_t received) {
+  // Keep the last payload byte - that's the answer to a checkRx / checkTx
+  bool hasLengthByte = mFrameHasLength && mFrameIndex == 1;
+  if (mFrameIndex > 0 && !hasLengthByte) {
+    mFrameResult = received;
+    Command &command = mQueue[mQueueHead];
+    if (command.type == CommandType::readBytes && !mReadCheckPhase) {
+      size_t payloadIndex = mFrameIndex - 2;
+      command.rxBuffer[command.done + payloadIndex] = received;
+    }
+  }
+
+  mFrameIndex++;
+  if (mFrameIndex < 1 + (mFrameHasLength ? 1 : 0) + mFrameLength) {
+    writeSPIByte(nextFrameByte());
+  } else {
+    MULTIUART::deselect();
+    onFrameComplete();
+  }
+}
+
+/*******************************
+ * SPI hardware access
+ *******************************/
+void MULTIUARTAsync::writeSPIByte(uint8_t data) {
+#ifdef __AVR__
+  SPDR = data;
+#else
+  (void) data;
+#endif
+}
+
+void MULTIUARTAsync::setTransferInterrupt(bool enabled) {
+#if defined(__AVR__) && defined(MULTIUART_ASYNC_USE_ISR)
+  if (enabled) {
+    SPCR |= _BV(SPIE);
+  } else {
+    SPCR &= ~_BV(SPIE);
+  }
+#else
+  (void) enabled;
+#endif
+}
+
+bool MULTIUARTAsync::isTransferComplete() {
+#ifdef __AVR__
+  return SPSR & _BV(SPIF);
+#else
+  return false;
+#endif
+}
+
+uint8_t MULTIUARTAsync::readSPIByte() {
+#ifdef __AVR__
+  return SPDR;
+#else
+  return 0xFF;
+#endif
+}
+
+/*******************************
+ * Private functions
+ *******************************/
+bool MULTIUARTAsync::enqueue(const Command &command) {
+  if ((uint8_t) command.uart >= 4) return false;
+  // Don't start talking to the board while it's writing to flash
+  if (mQueueCount == 0) waitForSettle();
+
+  bool queued = false;
+  // Note: This may be called from a completion callback (i.e. inside the interrupt) so restore rather than enable interrupts
+#ifdef __AVR__
+  uint8_t oldSREG = SREG;
+  cli();
+#else
+  noInterrupts();
+#endif
+  if (mQueueCount < MULTIUART_ASYNC_QUEUE_SIZE) {
+    mQueue[(mQueueHead + mQueueCount) % MULTIUART_ASYNC_QUEUE_SIZE] = command;
+    mQueueCount++;
+    queued = true;
+    // Nothing in progress so this needs kicking off, otherwise the interrupt will get to it
+    if (mQueueCount == 1) {
+      setTransferInterrupt(true);
+      startCommand();
+    }
+  }
+#ifdef __AVR__
+  SREG = oldSREG;
+#else
+  interrupts();
+#endif
+  return queued;
+}
+
+void MULTIUARTAsync::startCommand() {
+  Command &command = mQueue[mQueueHead];
+  switch (command.type) {
+    case CommandType::checkRx:
+      startFrame(0x10 | command.uart, false, 1);
+      break;
+    case CommandType::checkTx:
+      startFrame(0x30 | command.uart, false, 1);
+      break;
+    case CommandType::readBytes:
+      // Find out how much is queued first - asking for more would desynchronise the board
+      mReadCheckPhase = true;
+      startFrame(0x10 | command.uart, false, 1);
+      break;
+    case CommandType::transmitBytes:
+      if (command.length == 0) {
+        // Nothing to send, but clock out a TX queue check so the callback still comes from the transfer complete handler
+        startFrame(0x30 | command.uart, false, 1);
+      } else {
+        startFrame(0x40 | command.uart, true, min(command.length, MULTIUART_MAX_TRANSFER));
+      }
+      break;
+  }
+}
+
+void MULTIUARTAsync::startFrame(uint8_t opcode, bool hasLength, uint8_t length) {
+  mFrameOpcode = opcode;
+  mFrameHasLength = hasLength;
+  mFrameLength = length;
+  mFrameIndex = 0;
+  MULTIUART::select();
+  writeSPIByte(opcode);
+}
+
+void MULTIUARTAsync::onFrameComplete() {
+  Command &command = mQueue[mQueueHead];
+  switch (command.type) {
+    case CommandType::checkRx:
+    case CommandType::checkTx:
+      completeCommand(mFrameResult);
+      break;
+    case CommandType::readBytes:
+      if (mReadCheckPhase) {
+        mReadCheckPhase = false;
+        size_t chunk = min(command.length, MULTIUART_MAX_TRANSFER);
+        if (mFrameResult < chunk) chunk = mFrameResult;
+        if (chunk == 0) {
+          completeCommand(0);
+        } else {
+          startFrame(0x20 | command.uart, true, chunk);
+        }
+      } else {
+        command.done += mFrameLength;
+        completeCommand(command.done);
+      }
+      break;
+    case CommandType::transmitBytes:
+      if (command.length == 0) {
+        completeCommand(0);
+        break;
+      }
+      command.done += mFrameLength;
+      if (command.done < command.length) {
+        startFrame(0x40 | command.uart, true, min(command.length - command.done, MULTIUART_MAX_TRANSFER));
+      } else {
+        completeCommand(command.done);
+      }
+      break;
+  }
+}
+
+void MULTIUARTAsync::completeCommand(size_t result) {
+  Command &command = mQueue[mQueueHead];
+  if (command.onComplete) {
+    mInCallback = true;
+    command.onComplete(command.context, command.uart, result);
+    mInCallback = false;
+  }
+
+  mQueueHead = (mQueueHead + 1) % MULTIUART_ASYNC_QUEUE_SIZE;
+  mQueueCount--;
+  if (mQueueCount > 0) {
+    startCommand();
+  } else {
+    setTransferInterrupt(false);
+  }
+}
+
+uint8_t MULTIUARTAsync::nextFrameByte() {
+  if (mFrameIndex == 0) return mFrameOpcode;
+  if (mFrameHasLength && mFrameIndex == 1) return mFrameLength;
+
+  Command &command = mQueue[mQueueHead];
+  if (command.type == CommandType::transmitBytes) {
+    size_t payloadIndex = mFrameIndex - 2;
+    return command.txData[command.done + payloadIndex];
+  }
+  return 0xFF;
+}
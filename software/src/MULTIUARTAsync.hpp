@@ -0,0 +1,164 @@
+/*****************
+MULTIUART Arduino Library - interrupt driven variant
+
+MULTIUARTAsync adds a non-blocking command queue on top of MULTIUART.
+checkRx / checkTx / readBytes / transmitBytes requests are queued with a
+completion callback and clocked out one byte at a time as each SPI transfer
+completes, so the main loop can get on with other work while the bytes move.
+
+The SPI transfer complete interrupt handler is only compiled in when
+MULTIUART_ASYNC_USE_ISR is defined (e.g. -D MULTIUART_ASYNC_USE_ISR in
+build_flags), so firmware that doesn't use this class doesn't take the
+SPI_STC vector. Without it, call poll() regularly (e.g. every loop) to move
+the queue along instead.
+
+Notes:
+- Completion callbacks are called from the SPI interrupt (or from poll()),
+  never from the call that queued the command. Keep them short and don't do
+  any (blocking) Serial output from them.
+- Don't call the blocking MULTIUART functions from a completion callback
+  either. The bus is free while a callback runs, so they won't deadlock, but
+  they hold up the interrupt for the whole command.
+- Buffers passed to the async calls must stay valid until their callback.
+- The blocking MULTIUART calls still work; they wait for the queue to empty
+  before using the bus.
+- Only one MULTIUARTAsync can be active at a time as there's one SPI interrupt.
+- The SPI hardware access is done through the protected virtual functions
+  writeSPIByte() / setTransferInterrupt() / isTransferComplete() /
+  readSPIByte(). The native tests (test/test_async) override them with a
+  simulated board.
+*****************/
+
+#ifndef __MULTIUARTASYNC_H_INCLUDED__
+#define __MULTIUARTASYNC_H_INCLUDED__
+
+#include <Arduino.h>
+
+#include "MULTIUART.hpp"
+
+// How many commands can be queued at once
+#ifndef MULTIUART_ASYNC_QUEUE_SIZE
+#define MULTIUART_ASYNC_QUEUE_SIZE 8
+#endif
+
+class MULTIUARTAsync : public MULTIUART {
+
+public:
+
+  // Called when a queued command completes with the UART index and the result (byte count or queue depth)
+  typedef void (*CompletionFuncPtr)(void *context, char UART, size_t result);
+
+  /*******************************
+   * Constructors
+   *******************************/
+  MULTIUARTAsync(uint8_t ss);
+
+  /*******************************
+   * Getters / Setters
+   *******************************/
+  // Returns true if there are commands queued or in progress
+  bool isBusy();
+
+  /*******************************
+   * Actions
+   *******************************/
+  /* Queue a request for the number of received bytes held for the UART.
+   * Returns false if the queue is full. */
+  bool checkRxAsync(char UART, CompletionFuncPtr onComplete, void *context);
+  /* Queue a request for the number of bytes waiting to be transmitted on the UART.
+   * Returns false if the queue is full. */
+  bool checkTxAsync(char UART, CompletionFuncPtr onComplete, void *context);
+  /* Queue a read of up to length received bytes (no more than the board has
+   * queued, and at most MULTIUART_MAX_TRANSFER). The callback gets the number
+   * of bytes read. Returns false if the queue is full. */
+  bool readBytesAsync(uint8_t *buffer, char UART, size_t length, CompletionFuncPtr onComplete, void *context);
+  /* Queue a transmit of length bytes. The callback gets the number of bytes
+   * sent. Returns false if the queue is full. */
+  bool transmitBytesAsync(char UART, const uint8_t *data, size_t length, CompletionFuncPtr onComplete, void *context);
+  // Wait until all queued commands have completed
+  void waitUntilIdle();
+  /* Moves the queue along if the SPI transfer in progress has completed.
+   * Only needed when the interrupt handler isn't compiled in (see
+   * MULTIUART_ASYNC_USE_ISR), but harmless otherwise. */
+  void poll();
+
+  /* Called when each SPI byte transfer completes with the byte that was
+   * received (from the SPI interrupt, or from poll()) */
+  void onTransferComplete(uint8_t received);
+
+protected:
+
+  // Wait for the queue to empty before a blocking command uses the bus
+  void select() override;
+
+  // Start clocking out a byte. The default uses the SPI data register.
+  virtual void writeSPIByte(uint8_t data);
+  // Turn the SPI transfer complete interrupt on or off (does nothing unless MULTIUART_ASYNC_USE_ISR is defined)
+  virtual void setTransferInterrupt(bool enabled);
+  // Returns true if the byte being clocked out has finished (for poll())
+  virtual bool isTransferComplete();
+  // The byte received by the last transfer
+  virtual uint8_t readSPIByte();
+
+private:
+
+  enum class CommandType : uint8_t {
+    checkRx,
+    checkTx,
+    readBytes,
+    transmitBytes
+  };
+
+  struct Command {
+    CommandType type;
+    char uart;
+    uint8_t *rxBuffer;
+    const uint8_t *txData;
+    size_t length;
+    // Bytes moved so far
+    size_t done;
+    CompletionFuncPtr onComplete;
+    void *context;
+  };
+
+  /*******************************
+   * Member variables
+   *******************************/
+  // Circular queue of commands. The command at mQueueHead is the one in progress.
+  Command mQueue[MULTIUART_ASYNC_QUEUE_SIZE];
+  volatile uint8_t mQueueHead = 0;
+  volatile uint8_t mQueueCount = 0;
+  // The command byte of the frame being clocked out (one chip select cycle)
+  uint8_t mFrameOpcode = 0;
+  // True if the frame sends a length byte after the command byte
+  bool mFrameHasLength = false;
+  // Number of payload bytes in the frame
+  uint8_t mFrameLength = 0;
+  // Number of bytes of the frame clocked out so far
+  uint16_t mFrameIndex = 0;
+  // True while a readBytes command is asking how much it can read
+  bool mReadCheckPhase = false;
+  // The last payload byte received in the frame
+  uint8_t mFrameResult = 0;
+  // True while a completion callback is running
+  volatile bool mInCallback = false;
+
+  /*******************************
+   * Private functions
+   *******************************/
+  // Add a command to the queue and start it if the bus is idle
+  bool enqueue(const Command &command);
+  // Start the first frame of the command at the head of the queue
+  void startCommand();
+  // Start clocking out a frame
+  void startFrame(uint8_t opcode, bool hasLength, uint8_t length);
+  // Work out what to do now the current frame has been clocked out
+  void onFrameComplete();
+  // Report the result of the command at the head of the queue and move on to the next
+  void completeCommand(size_t result);
+  // The byte to send at the current position in the frame
+  uint8_t nextFrameByte();
+
+};
+
+#endif // __MULTIUARTASYNC_H_INCLUDED__
@@ -0,0 +1,88 @@
+#include "MULTIUARTBus.hpp"
+
+/*******************************
+ * Constructors
+ *******************************/
+MULTIUARTBus::MULTIUARTBus() {
+  for (uint8_t i = 0; i < MULTIUART_BUS_MAX_BOARDS; i++) {
+    mBoards[i] = nullptr;
+    mBoardPriorities[i] = 0;
+  }
+  for (uint8_t i = 0; i < MULTIUART_BUS_MAX_BOARDS * MULTIUART_UART_COUNT; i++) {
+    mStreams[i] = nullptr;
+  }
+}
+
+/*******************************
+ * Getters / Setters
+ *******************************/
+uint8_t MULTIUARTBus::getBoardCount() {
+  return mBoardCount;
+}
+
+MULTIUART* MULTIUARTBus::getBoard(uint8_t boardIndex) {
+  if (boardIndex >= mBoardCount) return nullptr;
+  return mBoards[boardIndex];
+}
+
+uint8_t MULTIUARTBus::getChannelCount() {
+  return mBoardCount * MULTIUART_UART_COUNT;
+}
+
+void MULTIUARTBus::setBoardPriority(uint8_t boardIndex, uint8_t priority) {
+  if (boardIndex < mBoardCount) mBoardPriorities[boardIndex] = priority;
+}
+
+void MULTIUARTBus::setChannelPriority(uint8_t channel, uint8_t priority) {
+  if (channel >= getChannelCount()) return;
+  mBoards[channel / MULTIUART_UART_COUNT]->setPriority(channel % MULTIUART_UART_COUNT, priority);
+}
+
+/*******************************
+ * Actions
+ *******************************/
+int MULTIUARTBus::addBoard(MULTIUART *board) {
+  if (mBoardCount >= MULTIUART_BUS_MAX_BOARDS) return -1;
+  mBoards[mBoardCount] = board;
+  return mBoardCount++;
+}
+
+void MULTIUARTBus::initialise(int SPIDivider) {
+  // The SPI peripheral is shared so it only needs setting up once
+  if (mBoardCount > 0) mBoards[0]->initialise(SPIDivider);
+}
+
+MUARTSingleStream* MULTIUARTBus::getStream(uint8_t channel) {
+  if (channel >= getChannelCount()) return nullptr;
+  if (!mStreams[channel]) {
+    mStreams[channel] = new MUARTSingleStream(mBoards[channel / MULTIUART_UART_COUNT], channel % MULTIUART_UART_COUNT);
+  }
+  return mStreams[channel];
+}
+
+size_t MULTIUARTBus::service(size_t byteBudget) {
+  if (mBoardCount == 0) return 0;
+
+  // Service order: highest priority first, and within a priority starting from mNextBoard
+  uint8_t order[MULTIUART_BUS_MAX_BOARDS];
+  for (uint8_t i = 0; i < mBoardCount; i++) {
+    uint8_t board = (mNextBoard + i) % mBoardCount;
+    uint8_t j = i;
+    while (j > 0 && mBoardPriorities[order[j - 1]] < mBoardPriorities[board]) {
+      order[j] = order[j - 1];
+      j--;
+    }
+    order[j] = board;
+  }
+
+  size_t moved = 0;
+  uint8_t serviced = 0;
+  while (serviced < mBoardCount && moved < byteBudget) {
+    moved += mBoards[order[serviced]]->serviceAll(byteBudget - moved);
+    serviced++;
+  }
+
+  // Start from the first board that missed out next time, otherwise just move on one
+  mNextBoard = (serviced < mBoardCount) ? order[serviced] : (mNextBoard + 1) % mBoardCount;
+  return moved;
+}
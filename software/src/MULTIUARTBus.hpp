@@ -0,0 +1,76 @@
+#ifndef __MULTIUARTBUS_H_INCLUDED__
+#define __MULTIUARTBUS_H_INCLUDED__
+
+#include <Arduino.h>
+
+#include "MULTIUART.hpp"
+#include "MUARTSingleStream.hpp"
+
+// The most MULTIUART boards a bus can manage
+#ifndef MULTIUART_BUS_MAX_BOARDS
+#define MULTIUART_BUS_MAX_BOARDS 4
+#endif
+
+/* Manages several MULTIUART boards sharing one SPI bus (common SCK / MOSI /
+ * MISO with a chip select each). UARTs are addressed by a global channel
+ * number: board 0 has channels 0-3, board 1 has channels 4-7, and so on. */
+class MULTIUARTBus {
+
+public:
+
+  /*******************************
+   * Constructors
+   *******************************/
+  MULTIUARTBus();
+
+  /*******************************
+   * Getters / Setters
+   *******************************/
+  // Number of boards on the bus
+  uint8_t getBoardCount();
+  // Get one of the boards on the bus (nullptr if there isn't one with that index)
+  MULTIUART* getBoard(uint8_t boardIndex);
+  // Number of UART channels across all the boards on the bus
+  uint8_t getChannelCount();
+  /* Set the order service() services the board in. Higher priority boards are
+   * serviced first, boards with the same priority take turns (default 0). */
+  void setBoardPriority(uint8_t boardIndex, uint8_t priority);
+  // Set the order a channel is serviced in on its board. Higher priority channels are serviced first (default 0).
+  void setChannelPriority(uint8_t channel, uint8_t priority);
+
+  /*******************************
+   * Actions
+   *******************************/
+  // Add a board to the bus. Returns the board index, or -1 if the bus is full.
+  int addBoard(MULTIUART *board);
+  // Initialises the SPI peripheral shared by all the boards
+  void initialise(int SPIDivider);
+  /* Get the stream for a global channel number, creating it the first time
+   * it's asked for (nullptr if there's no such channel). Call begin() on it
+   * to set the baud rate as usual. */
+  MUARTSingleStream* getStream(uint8_t channel);
+  /* Services all the boards (see MULTIUART::serviceAll()) until byteBudget
+   * bytes have been moved. Boards that didn't get a look in because the
+   * budget ran out are serviced first next time. Returns the number of bytes
+   * moved. */
+  size_t service(size_t byteBudget = MULTIUART_NO_BUDGET);
+
+private:
+
+  /*******************************
+   * Member variables
+   *******************************/
+  // The boards on the bus
+  MULTIUART *mBoards[MULTIUART_BUS_MAX_BOARDS];
+  // The service priority of each board
+  uint8_t mBoardPriorities[MULTIUART_BUS_MAX_BOARDS];
+  // Number of boards on the bus
+  uint8_t mBoardCount = 0;
+  // The streams handed out for each global channel (nullptr until asked for)
+  MUARTSingleStream *mStreams[MULTIUART_BUS_MAX_BOARDS * MULTIUART_UART_COUNT];
+  // The board to start servicing from next time (among boards of equal priority)
+  uint8_t mNextBoard = 0;
+
+};
+
+#endif // __MULTIUARTBUS_H_INCLUDED__
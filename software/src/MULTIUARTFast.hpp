@@ -0,0 +1,151 @@
+/*****************
+MULTIUART Arduino Library - compile time specialised variant
+
+MULTIUARTFast works exactly like MULTIUART, but the chip select pin and the
+SPI settings are template parameters. On the ATmega2560 the chip select
+port register and bit mask are worked out at compile time, so selecting the
+board is one or two instructions rather than a pair of digitalWrite() calls,
+and every command is wrapped in SPI.beginTransaction() / endTransaction() so
+the bus can safely be shared with other SPI devices.
+
+Usage (chip select on pin 53, 250kHz SPI clock):
+
+  MULTIUARTFast<53, 250000> gMultiuart;
+  ...
+  gMultiuart.initialise();
+*****************/
+
+#ifndef __MULTIUARTFAST_H_INCLUDED__
+#define __MULTIUARTFAST_H_INCLUDED__
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#include "MULTIUART.hpp"
+
+// Default SPI clock / Hz (the equivalent of SPI_CLOCK_DIV64 on a 16MHz board)
+static const uint32_t MULTIUART_DEFAULT_SPI_CLOCK = 250000;
+
+namespace MULTIUARTPins {
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+  // Compile time pin mapping for the Arduino Mega. These mirror the tables in the Mega's pins_arduino.h.
+  #define MULTIUART_CS_COMPILE_TIME
+
+  // Data space address of the PORTx output register for the pin (0 if it isn't a digital pin)
+  constexpr uint16_t portAddress(uint8_t pin) {
+    return (pin <= 3 || pin == 5) ? 0x2E               // PORTE
+      : (pin == 4) ? 0x34                              // PORTG
+      : (pin <= 9) ? 0x102                             // PORTH
+      : (pin <= 13) ? 0x25                             // PORTB
+      : (pin <= 15) ? 0x105                            // PORTJ
+      : (pin <= 17) ? 0x102                            // PORTH
+      : (pin <= 21) ? 0x2B                             // PORTD
+      : (pin <= 29) ? 0x22                             // PORTA
+      : (pin <= 37) ? 0x28                             // PORTC
+      : (pin == 38) ? 0x2B                             // PORTD
+      : (pin <= 41) ? 0x34                             // PORTG
+      : (pin <= 49) ? 0x10B                            // PORTL
+      : (pin <= 53) ? 0x25                             // PORTB
+      : (pin <= 61) ? 0x31                             // PORTF
+      : (pin <= 69) ? 0x108                            // PORTK
+      : 0;
+  }
+
+  // Bit number of the pin within its port
+  constexpr uint8_t portBit(uint8_t pin) {
+    return (pin <= 1) ? pin
+      : (pin <= 3) ? pin + 2
+      : (pin == 4) ? 5
+      : (pin == 5) ? 3
+      : (pin <= 9) ? pin - 3
+      : (pin <= 13) ? pin - 6
+      : (pin <= 15) ? 15 - pin
+      : (pin <= 17) ? 17 - pin
+      : (pin <= 21) ? 21 - pin
+      : (pin <= 29) ? pin - 22
+      : (pin <= 37) ? 37 - pin
+      : (pin == 38) ? 7
+      : (pin <= 41) ? 41 - pin
+      : (pin <= 49) ? 49 - pin
+      : (pin <= 53) ? 53 - pin
+      : (pin <= 61) ? pin - 54
+      : pin - 62;
+  }
+#endif
+
+}
+
+template<uint8_t CSPin, uint32_t SPIClockHz = MULTIUART_DEFAULT_SPI_CLOCK, uint8_t SPIMode = SPI_MODE0>
+class MULTIUARTFast : public MULTIUART {
+
+public:
+
+  MULTIUARTFast() : MULTIUART(CSPin) {
+    deselectPin();
+  }
+
+  // Initialises the SPI peripheral. The clock settings are applied per command by the SPI transaction.
+  void initialise() {
+    SPI.begin();
+  }
+
+  // Each command's SPI transaction sets the clock to SPIClockHz, so a tuned divider would never be used
+  int autoTuneClock(char loopbackUART, uint8_t marginSteps = 1) = delete;
+
+protected:
+
+  void select() override {
+    SPI.beginTransaction(SPISettings(SPIClockHz, MSBFIRST, SPIMode));
+    selectPin();
+  }
+
+  void deselect() override {
+    deselectPin();
+    SPI.endTransaction();
+  }
+
+private:
+
+#ifdef MULTIUART_CS_COMPILE_TIME
+  static constexpr uint16_t CS_PORT = MULTIUARTPins::portAddress(CSPin);
+  static constexpr uint8_t CS_MASK = 1 << MULTIUARTPins::portBit(CSPin);
+  // Ports in the I/O space can be changed with a single (atomic) sbi / cbi instruction
+  static constexpr bool CS_ATOMIC = CS_PORT < 0x40;
+  static_assert(CS_PORT != 0, "MULTIUARTFast: CSPin is not a digital pin on this board");
+
+  static inline void selectPin() {
+    if (CS_ATOMIC) {
+      _SFR_MEM8(CS_PORT) &= ~CS_MASK;
+    } else {
+      uint8_t oldSREG = SREG;
+      cli();
+      _SFR_MEM8(CS_PORT) &= ~CS_MASK;
+      SREG = oldSREG;
+    }
+  }
+
+  static inline void deselectPin() {
+    if (CS_ATOMIC) {
+      _SFR_MEM8(CS_PORT) |= CS_MASK;
+    } else {
+      uint8_t oldSREG = SREG;
+      cli();
+      _SFR_MEM8(CS_PORT) |= CS_MASK;
+      SREG = oldSREG;
+    }
+  }
+#else
+  // No compile time pin mapping for this board so fall back to the Arduino API
+  static inline void selectPin() {
+    digitalWrite(CSPin, LOW);
+  }
+
+  static inline void deselectPin() {
+    digitalWrite(CSPin, HIGH);
+  }
+#endif
+
+};
+
+#endif // __MULTIUARTFAST_H_INCLUDED__
@@ -0,0 +1,131 @@
+#include "SensorArray.hpp"
+
+using namespace A02YYUW;
+
+/*******************************
+ * Constructors
+ *******************************/
+SensorArray::SensorArray(unsigned long periodMs) {
+  mPeriod = periodMs;
+  for (uint8_t i = 0; i < SENSOR_ARRAY_MAX_SENSORS; i++) {
+    mSensors[i] = nullptr;
+  }
+}
+
+/*******************************
+ * Getters / Setters
+ *******************************/
+uint8_t SensorArray::getSensorCount() {
+  return mSensorCount;
+}
+
+A02YYUWviaUARTStream* SensorArray::getSensor(uint8_t index) {
+  if (index >= mSensorCount) return nullptr;
+  return mSensors[index];
+}
+
+unsigned long SensorArray::getPeriod() {
+  return mPeriod;
+}
+
+void SensorArray::setPeriod(unsigned long periodMs) {
+  mPeriod = periodMs;
+}
+
+uint8_t SensorArray::getSlotCount() {
+  return mSlotCount;
+}
+
+void SensorArray::setSlotCount(uint8_t slotCount) {
+  mSlotCount = slotCount;
+  mCurrentSlot = 0xFF;
+}
+
+uint8_t SensorArray::getCurrentSlot() {
+  return mCurrentSlot;
+}
+
+bool SensorArray::isCrosstalkAvoidance() {
+  return mCrosstalkAvoidance;
+}
+
+void SensorArray::setCrosstalkAvoidance(bool crosstalkAvoidance) {
+  mCrosstalkAvoidance = crosstalkAvoidance;
+  for (uint8_t i = 0; i < mSensorCount; i++) {
+    mSensors[i]->setTriggered(crosstalkAvoidance);
+  }
+  // Start the schedule again so the first slot is triggered before it's read
+  mCurrentSlot = 0xFF;
+}
+
+/*******************************
+ * Actions
+ *******************************/
+int SensorArray::addSensor(A02YYUWviaUARTStream *sensor) {
+  if (mSensorCount >= SENSOR_ARRAY_MAX_SENSORS) return -1;
+  // The slots are about to change, so start the schedule again
+  mCurrentSlot = 0xFF;
+  if (mCrosstalkAvoidance) sensor->setTriggered(true);
+  mSensors[mSensorCount] = sensor;
+  return mSensorCount++;
+}
+
+uint8_t SensorArray::service() {
+  uint8_t slots = activeSlotCount();
+  if (slots == 0) return 0;
+
+  unsigned long now = millis();
+  if (mCrosstalkAvoidance) return serviceTriggered(slots, now);
+
+  if (mCurrentSlot == 0xFF) mStartTime = now;
+  unsigned long slotLength = max(mPeriod / slots, 1UL);
+  uint8_t slot = ((now - mStartTime) / slotLength) % slots;
+  mCurrentSlot = slot;
+
+  uint8_t newReadings = 0;
+  for (uint8_t i = slot; i < mSensorCount; i += slots) {
+    unsigned long lastSuccess = mSensors[i]->getLastReadSuccess();
+    mSensors[i]->readDistance();
+    if (mSensors[i]->getLastReadSuccess() != lastSuccess) newReadings++;
+  }
+  return newReadings;
+}
+
+/*******************************
+ * Private functions
+ *******************************/
+uint8_t SensorArray::activeSlotCount() {
+  if (mSlotCount == 0 || mSlotCount > mSensorCount) return mSensorCount;
+  return mSlotCount;
+}
+
+uint8_t SensorArray::serviceTriggered(uint8_t slots, unsigned long now) {
+  uint8_t newReadings = 0;
+  bool pending = false;
+  if (mCurrentSlot != 0xFF) {
+    // Keep reading the slot's sensors until each has its answer or has timed out
+    for (uint8_t i = mCurrentSlot; i < mSensorCount; i += slots) {
+      if (!mSensors[i]->isMeasurementPending()) continue;
+      mSensors[i]->readDistance();
+      if (mSensors[i]->isMeasurementPending()) {
+        pending = true;
+      } else if (mSensors[i]->getLastReadResult() == 0) {
+        newReadings++;
+      }
+    }
+    // Only one slot's sensors are pinging at a time, and their echoes have to die away first
+    unsigned long slotLength = max(mPeriod / slots, ECHO_SETTLE_MS);
+    if (pending || now - mSlotStartTime < slotLength) return newReadings;
+  }
+
+  mCurrentSlot = (mCurrentSlot == 0xFF) ? 0 : (mCurrentSlot + 1) % slots;
+  mSlotStartTime = now;
+  triggerSlot(mCurrentSlot);
+  return newReadings;
+}
+
+void SensorArray::triggerSlot(uint8_t slot) {
+  for (uint8_t i = slot; i < mSensorCount; i += activeSlotCount()) {
+    mSensors[i]->requestMeasurement();
+  }
+}
@@ -0,0 +1,110 @@
+#ifndef __SENSORARRAY_H_INCLUDED__
+#define __SENSORARRAY_H_INCLUDED__
+
+#include <Arduino.h>
+
+#include "A02YYUWviaUARTStream.hpp"
+
+// The most sensors an array can manage
+#ifndef SENSOR_ARRAY_MAX_SENSORS
+#define SENSOR_ARRAY_MAX_SENSORS 16
+#endif
+
+namespace A02YYUW {
+
+  /* Schedules reads across a set of A02YYUW sensors. The read period is
+   * split into slots and each sensor is only read during its own slot, so
+   * the SPI traffic is spread evenly across the period rather than every
+   * sensor being polled in the same loop pass.
+   *
+   * Sensor i is in slot i % slotCount. By default there's one slot per
+   * sensor; with fewer slots, sensors share them but neighbouring sensors
+   * (consecutive indexes) are still in different slots as long as there are
+   * at least 2.
+   *
+   * With crosstalk avoidance on, the array puts the sensors in triggered
+   * mode (they must have UART controlled output) and requests a measurement
+   * from each slot's sensors at the start of their slot, so no neighbouring
+   * sensors ping at the same time. The next slot doesn't start until every
+   * sensor in the current one has answered (or timed out) and at least
+   * ECHO_SETTLE_MS has passed, so a slot is never shorter than an echo takes
+   * to die away, however short period / slots is. A cycle can then take
+   * longer than the period. */
+  class SensorArray {
+
+  public:
+
+    /*******************************
+     * Constructors
+     *******************************/
+    SensorArray(unsigned long periodMs = READ_INTERVAL_MS);
+
+    /*******************************
+     * Getters / Setters
+     *******************************/
+    // Number of sensors in the array
+    uint8_t getSensorCount();
+    // Get one of the sensors in the array (nullptr if there isn't one with that index)
+    A02YYUWviaUARTStream* getSensor(uint8_t index);
+    // Time for every slot to have had its turn / ms
+    unsigned long getPeriod();
+    void setPeriod(unsigned long periodMs);
+    /* Number of slots the period is split into (0 = one slot per sensor,
+    * the default) */
+    uint8_t getSlotCount();
+    void setSlotCount(uint8_t slotCount);
+    // The slot currently being serviced
+    uint8_t getCurrentSlot();
+    // Returns true if the array triggers each slot's sensors itself
+    bool isCrosstalkAvoidance();
+    /* Set crosstalkAvoidance = true to put the sensors in triggered mode and
+    * have the array trigger each slot's sensors at the start of the slot
+    * (sensors must have UART controlled output). Setting it false puts them
+    * back to free-running. */
+    void setCrosstalkAvoidance(bool crosstalkAvoidance);
+
+    /*******************************
+     * Actions
+     *******************************/
+    // Add a sensor to the array. Returns the sensor index, or -1 if the array is full.
+    int addSensor(A02YYUWviaUARTStream *sensor);
+    /* Reads the sensors whose turn it is. Call this every loop. Returns the
+    * number of sensors that got a new reading. */
+    uint8_t service();
+
+  private:
+
+    /*******************************
+     * Member variables
+     *******************************/
+    // The sensors in the array
+    A02YYUWviaUARTStream *mSensors[SENSOR_ARRAY_MAX_SENSORS];
+    // Number of sensors in the array
+    uint8_t mSensorCount = 0;
+    // Time for every slot to have had its turn / ms
+    unsigned long mPeriod;
+    // Number of slots the period is split into (0 = one per sensor)
+    uint8_t mSlotCount = 0;
+    // The slot currently being serviced (0xFF until the first service)
+    uint8_t mCurrentSlot = 0xFF;
+    // If true, the array triggers each slot's sensors at the start of the slot
+    bool mCrosstalkAvoidance = false;
+    // The time the schedule started / ms since reset
+    unsigned long mStartTime = 0;
+    // Crosstalk avoidance: the time the current slot's sensors were triggered / ms since reset
+    unsigned long mSlotStartTime = 0;
+
+    /*******************************
+     * Private functions
+     *******************************/
+    // Number of slots actually in use
+    uint8_t activeSlotCount();
+    // Crosstalk avoidance: collect the current slot's readings and start the next slot once they're all in
+    uint8_t serviceTriggered(uint8_t slots, unsigned long now);
+    // Request a measurement from every sensor in a slot
+    void triggerSlot(uint8_t slot);
+
+  };
+
+}
+#endif // __SENSORARRAY_H_INCLUDED__
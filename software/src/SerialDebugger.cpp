@@ -1,12 +1,13 @@
 #include "SerialDebugger.hpp"
 
-SerialDebugger::SerialDebugger(unsigned long baud, bool getInput) : SerialDisplay(SerialDisplayType::ansi_vt100) {
+const char SerialDebugger::TIME_PREFIX[] PROGMEM = "------ Now: ";
+
+SerialDebugger::SerialDebugger(unsigned long baud, bool getInput, SerialDisplayType displayType) : SerialDisplay(displayType) {
   Serial.begin(baud);
   // Wait for initialisation of the serial interface
   while(!Serial);
   mGetInput = getInput;
   mValueSelection = true;
-  mStatusValues = HashMap<String, String, MAX_DEBUG_VALUES>();
 }
 
 /*******************************
@@ -19,62 +20,412 @@ void SerialDebugger::onValueChanged(volatile VoidFuncStringStringPtr onHandlerFu
 /*******************************
  * Actions
  *******************************/
+int SerialDebugger::registerValue(const __FlashStringHelper *label) {
+  return addSlot((const char *) label, true);
+}
+
+bool SerialDebugger::setValue(int handle, const char *value) {
+  DebugSlot *slot = getSlot(handle);
+  if (!slot) return false;
+  // The text behind the pointer may have changed, so always redraw it
+  slot->type = DebugValueType::text;
+  slot->value.text = value;
+  markLineDirty(valueLine(handle));
+  return true;
+}
+
+bool SerialDebugger::setValue(int handle, unsigned long value) {
+  DebugSlot *slot = getSlot(handle);
+  if (!slot) return false;
+  if (slot->type != DebugValueType::unsignedInteger || slot->value.unsignedInteger != value) {
+    slot->type = DebugValueType::unsignedInteger;
+    slot->value.unsignedInteger = value;
+    markLineDirty(valueLine(handle));
+  }
+  return true;
+}
+
+bool SerialDebugger::setValue(int handle, long value) {
+  DebugSlot *slot = getSlot(handle);
+  if (!slot) return false;
+  if (slot->type != DebugValueType::signedInteger || slot->value.signedInteger != value) {
+    slot->type = DebugValueType::signedInteger;
+    slot->value.signedInteger = value;
+    markLineDirty(valueLine(handle));
+  }
+  return true;
+}
+
+bool SerialDebugger::setValue(int handle, double value) {
+  return setValue(handle, (float) value);
+}
+
+bool SerialDebugger::setValue(int handle, float value) {
+  DebugSlot *slot = getSlot(handle);
+  if (!slot) return false;
+  if (slot->type != DebugValueType::floatingPoint || slot->value.floatingPoint != value) {
+    slot->type = DebugValueType::floatingPoint;
+    slot->value.floatingPoint = value;
+    markLineDirty(valueLine(handle));
+  }
+  return true;
+}
+
+bool SerialDebugger::setValue(int handle, int value) {
+  return setValue(handle, (long) value);
+}
+
+bool SerialDebugger::setValue(int handle, unsigned int value) {
+  return setValue(handle, (unsigned long) value);
+}
+
+bool SerialDebugger::setValue(int handle, bool value) {
+  DebugSlot *slot = getSlot(handle);
+  if (!slot) return false;
+  if (slot->type != DebugValueType::boolean || slot->value.boolean != value) {
+    slot->type = DebugValueType::boolean;
+    slot->value.boolean = value;
+    markLineDirty(valueLine(handle));
+  }
+  return true;
+}
+
 bool SerialDebugger::updateValue(String variable, String value) {
-  return internalUpdateValue(variable, value);
+  // The String won't be around when the value is printed, so this one has to be copied
+  DebugSlot *slot = getSlot(findOrAddSlot(variable));
+  if (!slot) return false;
+  if (slot->type != DebugValueType::copiedText || strncmp(slot->value.copiedText, value.c_str(), MAX_DEBUG_VALUE_LENGTH - 1) != 0) {
+    slot->type = DebugValueType::copiedText;
+    strncpy(slot->value.copiedText, value.c_str(), MAX_DEBUG_VALUE_LENGTH - 1);
+    slot->value.copiedText[MAX_DEBUG_VALUE_LENGTH - 1] = '\0';
+    markLineDirty(valueLine(slot - mSlots));
+  }
+  return true;
 }
 
 bool SerialDebugger::updateValue(String variable, unsigned long value) {
-  return internalUpdateValue(variable, String(value));
+  return setValue(findOrAddSlot(variable), value);
 }
 
 bool SerialDebugger::updateValue(String variable, double value) {
-  return internalUpdateValue(variable, String(value));
+  return setValue(findOrAddSlot(variable), value);
 }
 
 bool SerialDebugger::updateValue(String variable, float value) {
-  return internalUpdateValue(variable, String(value));
+  return setValue(findOrAddSlot(variable), value);
 }
 
 bool SerialDebugger::updateValue(String variable, int value) {
-  return internalUpdateValue(variable, String(value));
+  return setValue(findOrAddSlot(variable), value);
+}
+
+bool SerialDebugger::updateValue(String variable, unsigned int value) {
+  return setValue(findOrAddSlot(variable), value);
 }
 
 void SerialDebugger::processUserInput(String variable, String newValue) {
   if (mOnValueChangedHandlerFunction) mOnValueChangedHandlerFunction(variable, newValue);
 }
 
-bool SerialDebugger::internalUpdateValue(String variable, String value) {
-  // Check that we aren't going to add too many entries to the map
-  if (!mStatusValues.contains(variable) && mStatusValues.willOverflow()) return false;
-  mStatusValues[variable] = value;
-  return true;
+int SerialDebugger::addSlot(const char *label, bool labelInFlash) {
+  if (mSlotCount >= MAX_DEBUG_VALUES) return -1;
+  DebugSlot &slot = mSlots[mSlotCount];
+  slot.label = label;
+  slot.labelInFlash = labelInFlash;
+  slot.type = DebugValueType::none;
+  // The value goes after "<index>. <label>: "
+  unsigned int labelLength = labelInFlash ? strlen_P(label) : strlen(label);
+  slot.valueColumn = (mSlotCount < 10 ? 1 : 2) + 2 + labelLength + 2;
+  // There's a new line on the display
+  requestFullRedraw();
+  return mSlotCount++;
 }
 
-void SerialDebugger::printUpdate() {
-  clearSerialDisplay();
+int SerialDebugger::findOrAddSlot(const String &variable) {
+  for (uint8_t i = 0; i < mSlotCount; i++) {
+    const DebugSlot &slot = mSlots[i];
+    int comparison = slot.labelInFlash ? strcmp_P(variable.c_str(), slot.label) : strcmp(variable.c_str(), slot.label);
+    if (comparison == 0) return i;
+  }
+  if (mSlotCount >= MAX_DEBUG_VALUES) return -1;
+  // Note: The label copy is made once, when the value's first added, and is never freed
+  char *label = (char *) malloc(variable.length() + 1);
+  if (!label) return -1;
+  strcpy(label, variable.c_str());
+  return addSlot(label, false);
+}
 
-  Serial.println("------ Now: " + String(millis()) + " ---------");
+SerialDebugger::DebugSlot* SerialDebugger::getSlot(int handle) {
+  if (handle < 0 || handle >= mSlotCount) return nullptr;
+  return &mSlots[handle];
+}
 
-  for (unsigned int i=0; i<mStatusValues.size(); i++) {
-    Serial.println(String(i) + ". " + mStatusValues.keyAt(i) + ": " + mStatusValues.valueAt(i));
+const char* SerialDebugger::formatValue(const DebugSlot &slot, char *buffer) {
+  switch (slot.type) {
+    case DebugValueType::signedInteger:
+      return ltoa(slot.value.signedInteger, buffer, 10);
+    case DebugValueType::unsignedInteger:
+      return ultoa(slot.value.unsignedInteger, buffer, 10);
+    case DebugValueType::floatingPoint:
+      if (isnan(slot.value.floatingPoint)) return "nan";
+      if (isinf(slot.value.floatingPoint)) return slot.value.floatingPoint > 0 ? "inf" : "-inf";
+      // Big numbers wouldn't fit in the buffer with all their digits, so switch to scientific notation
+      if (fabs(slot.value.floatingPoint) >= MAX_DEBUG_FIXED_POINT_VALUE) return dtostre(slot.value.floatingPoint, buffer, 3, 0);
+      // Two decimal places, the same as String(value)
+      return dtostrf(slot.value.floatingPoint, 0, 2, buffer);
+    case DebugValueType::boolean:
+      return slot.value.boolean ? "true" : "false";
+    case DebugValueType::text:
+      return slot.value.text ? slot.value.text : "";
+    case DebugValueType::copiedText:
+      return slot.value.copiedText;
+    default:
+      return "";
   }
+}
 
-  if (mGetInput) {
-    if (mValueSelection) {
-      Serial.print("\nType number of value to change and <enter>: ");
-    } else {
-      Serial.print("\nType new value and <enter> (blank to cancel): ");
-    }
+void SerialDebugger::printLabel(const DebugSlot &slot) {
+  if (slot.labelInFlash) {
+    print((const __FlashStringHelper *) slot.label);
+  } else {
+    print(slot.label);
   }
 }
 
+String SerialDebugger::labelString(const DebugSlot &slot) {
+  if (slot.labelInFlash) return String((const __FlashStringHelper *) slot.label);
+  return String(slot.label);
+}
+
+uint8_t SerialDebugger::valueLine(int handle) {
+  // The time is on the first line
+  return handle + 1;
+}
+
+const __FlashStringHelper* SerialDebugger::prompt() {
+  if (mValueSelection) return F("Type number of value to change and <enter>: ");
+  return F("Type new value and <enter> (blank to cancel): ");
+}
+
+void SerialDebugger::printUpdate() {
+  // Finish off any frame that's part sent, then send a fresh one
+  while (!sendFrame(SERIAL_DISPLAY_NO_BUDGET));
+  startFrame();
+  while (!sendFrame(SERIAL_DISPLAY_NO_BUDGET));
+}
+
 void SerialDebugger::throttledPrintUpdate() {
+  // Keep sending the frame in progress before thinking about the next one
+  if (mFrameInProgress) {
+    sendFrame(mOutputBudget);
+    return;
+  }
+
   unsigned long now = millis();
   if (mNextPrintMillis == 0) mNextPrintMillis = now;
-  if (now > mNextPrintMillis) {
-    mNextPrintMillis = now + 200;
-    printUpdate();
+  if (now >= mNextPrintMillis) {
+    mNextPrintMillis = now + mUpdateInterval;
+    startFrame();
+    sendFrame(mOutputBudget);
+  }
+}
+
+bool SerialDebugger::isFrameInProgress() {
+  return mFrameInProgress;
+}
+
+unsigned long SerialDebugger::getOutputBudget() {
+  return mOutputBudget;
+}
+
+void SerialDebugger::setOutputBudget(unsigned long budgetUs) {
+  mOutputBudget = budgetUs;
+}
+
+unsigned long SerialDebugger::getUpdateInterval() {
+  return mUpdateInterval;
+}
+
+void SerialDebugger::setUpdateInterval(unsigned long intervalMs) {
+  mUpdateInterval = intervalMs;
+}
+
+void SerialDebugger::startFrame() {
+  mFrameIsFull = isFullRedrawNeeded();
+  // Anything that changes from here on is picked up by the next frame
+  if (mFrameIsFull) markAllLinesClean();
+  mFrameLine = 0;
+  mFrameInProgress = true;
+}
+
+bool SerialDebugger::sendFrame(unsigned long budgetUs) {
+  if (!mFrameInProgress) return true;
+
+  unsigned long start = micros();
+  // Compose the frame a line at a time, sending each before composing the next
+  while (sendOutput(start, budgetUs)) {
+    if (mFrameLine > valueLine(mSlotCount)) {
+      mFrameInProgress = false;
+      return true;
+    }
+    if (micros() - start >= budgetUs) return false;
+    if (getSerialDisplayType() == SerialDisplayType::binaryTelemetry) {
+      composeTelemetryLine(mFrameLine++, mFrameIsFull);
+    } else if (mFrameIsFull) {
+      composeFullLine(mFrameLine++);
+    } else {
+      composeChangedLine(mFrameLine++);
+    }
+  }
+  return false;
+}
+
+void SerialDebugger::composeFullLine(uint8_t line) {
+  // The time
+  if (line == 0) {
+    clearSerialDisplay();
+    print((const __FlashStringHelper *) TIME_PREFIX);
+    print(millis());
+    println(F(" ---------"));
+    return;
+  }
+
+  // After the values, the prompt
+  if (line == valueLine(mSlotCount)) {
+    if (mGetInput) {
+      println();
+      print(prompt());
+    }
+    return;
+  }
+
+  // Values are only formatted now they're actually being shown
+  uint8_t i = line - 1;
+  char buffer[MAX_DEBUG_VALUE_LENGTH];
+  print(i);
+  print(F(". "));
+  printLabel(mSlots[i]);
+  print(F(": "));
+  println(formatValue(mSlots[i], buffer));
+  markLineClean(line);
+}
+
+void SerialDebugger::composeChangedLine(uint8_t line) {
+  // The time's always changed
+  if (line == 0) {
+    moveCursor(0, sizeof(TIME_PREFIX) - 1);
+    print(millis());
+    print(F(" ---------"));
+    clearToEndOfLine();
+    return;
+  }
+
+  // Put the cursor back at the end of the prompt (after the values and a blank line)
+  if (line == valueLine(mSlotCount)) {
+    if (mGetInput) moveCursor(line + 1, strlen_P((const char *) prompt()));
+    return;
+  }
+
+  // Only rewrite the values that have changed, leaving the labels where they are
+  if (!isLineDirty(line)) return;
+  uint8_t i = line - 1;
+  char buffer[MAX_DEBUG_VALUE_LENGTH];
+  moveCursor(line, mSlots[i].valueColumn);
+  print(formatValue(mSlots[i], buffer));
+  clearToEndOfLine();
+  markLineClean(line);
+}
+
+void SerialDebugger::composeTelemetryLine(uint8_t line, bool full) {
+  uint8_t record[MAX_TELEMETRY_RECORD_LENGTH];
+  size_t length = 0;
+
+  if (line == 0) {
+    record[length++] = TELEMETRY_TIME;
+    length = appendTelemetryLong(record, length, millis());
+    writeTelemetryRecord(record, length);
+    return;
+  }
+
+  // There's no prompt line in a telemetry update
+  if (line == valueLine(mSlotCount)) return;
+  if (!full && !isLineDirty(line)) return;
+
+  uint8_t i = line - 1;
+  const DebugSlot &slot = mSlots[i];
+  if (full) {
+    // Let the host know what the value is called
+    record[length++] = TELEMETRY_LABEL;
+    record[length++] = i;
+    for (uint8_t c = 0; c < MAX_TELEMETRY_LABEL_LENGTH; c++) {
+      char next = slot.labelInFlash ? pgm_read_byte(slot.label + c) : slot.label[c];
+      if (next == '\0') break;
+      record[length++] = next;
+    }
+    // Without its label the host can't name the value, so try the whole update again next time
+    if (!writeTelemetryRecord(record, length)) requestFullRedraw();
+    length = 0;
+  }
+
+  record[length++] = TELEMETRY_VALUE;
+  record[length++] = i;
+  switch (slot.type) {
+    case DebugValueType::signedInteger:
+      record[length++] = TELEMETRY_TYPE_SIGNED;
+      length = appendTelemetryLong(record, length, slot.value.signedInteger);
+      break;
+    case DebugValueType::unsignedInteger:
+      record[length++] = TELEMETRY_TYPE_UNSIGNED;
+      length = appendTelemetryLong(record, length, slot.value.unsignedInteger);
+      break;
+    case DebugValueType::floatingPoint: {
+      record[length++] = TELEMETRY_TYPE_FLOAT;
+      uint32_t bits;
+      memcpy(&bits, &slot.value.floatingPoint, sizeof(bits));
+      length = appendTelemetryLong(record, length, bits);
+      break;
+    }
+    case DebugValueType::boolean:
+      record[length++] = TELEMETRY_TYPE_BOOL;
+      record[length++] = slot.value.boolean ? 1 : 0;
+      break;
+    case DebugValueType::text:
+    case DebugValueType::copiedText: {
+      record[length++] = TELEMETRY_TYPE_TEXT;
+      const char *text = slot.type == DebugValueType::text ? slot.value.text : slot.value.copiedText;
+      if (!text) text = "";
+      // Leave room for the length and the checksum
+      uint8_t textLength = min(strlen(text), (size_t) (MAX_TELEMETRY_RECORD_LENGTH - length - 2));
+      record[length++] = textLength;
+      memcpy(record + length, text, textLength);
+      length += textLength;
+      break;
+    }
+    default:
+      record[length++] = TELEMETRY_TYPE_NONE;
+      break;
+  }
+  // If the record didn't fit, leave the value marked as changed so it's sent next time
+  if (writeTelemetryRecord(record, length)) {
+    markLineClean(line);
+  } else {
+    markLineDirty(line);
+  }
+}
+
+bool SerialDebugger::writeTelemetryRecord(uint8_t *record, size_t length) {
+  uint8_t checksum = 0;
+  for (size_t i = 0; i < length; i++) checksum += record[i];
+  record[length++] = checksum;
+  return writeFrame(record, length);
+}
+
+size_t SerialDebugger::appendTelemetryLong(uint8_t *record, size_t length, uint32_t value) {
+  for (uint8_t i = 0; i < 4; i++) {
+    record[length++] = value & 0xFF;
+    value >>= 8;
   }
+  return length;
 }
 
 /**
@@ -119,18 +470,20 @@ void SerialDebugger::getAndProcessUserInputUpdates() {
     if (terminated) {
       if (mValueSelection) {
         long valueNumber = inputValue.toInt();
-        if (valueNumber > 0 && valueNumber < mStatusValues.size()) {
+        if (valueNumber > 0 && valueNumber < mSlotCount) {
           valueToChange = (int) valueNumber;
         }
         mValueSelection = false;
+        requestFullRedraw();
       } else {
         // If no new value entered, cancel out
         if (inputValue.length() != 0) {
-          String key = mStatusValues.keyAt(valueToChange);
+          String key = labelString(mSlots[valueToChange]);
           // Note: New string creation here is deliberate
           processUserInput(key, "" + inputValue);
         }
         mValueSelection = true;
+        requestFullRedraw();
       }
       // Whatever happens, it's terminated so start again
       inputValue = "";
@@ -2,31 +2,121 @@
 #define __SERIALDEBUGGER_H_INCLUDED__
 
 #include <Arduino.h>
-#include "HashMap.h"
 #include "SerialDisplay.hpp"
 
 const unsigned int MAX_DEBUG_VALUES = 15;
+// Space for a formatted value, and for a copied text value, including the terminator / bytes
+const unsigned int MAX_DEBUG_VALUE_LENGTH = 24;
+// Floating point values this big or bigger are shown in scientific notation so they fit
+const float MAX_DEBUG_FIXED_POINT_VALUE = 1e9;
+// Default time throttledPrintUpdate() can spend sending output each call / us
+const unsigned long DEFAULT_DEBUG_OUTPUT_BUDGET_US = 500;
+// Default time between updates / ms
+const unsigned long DEFAULT_DEBUG_UPDATE_INTERVAL_MS = 200;
 
+// Binary telemetry record types
+const uint8_t TELEMETRY_TIME = 0x01;
+const uint8_t TELEMETRY_LABEL = 0x02;
+const uint8_t TELEMETRY_VALUE = 0x03;
+// Binary telemetry value types
+const uint8_t TELEMETRY_TYPE_NONE = 0;
+const uint8_t TELEMETRY_TYPE_SIGNED = 1;
+const uint8_t TELEMETRY_TYPE_UNSIGNED = 2;
+const uint8_t TELEMETRY_TYPE_FLOAT = 3;
+const uint8_t TELEMETRY_TYPE_BOOL = 4;
+const uint8_t TELEMETRY_TYPE_TEXT = 5;
+// Longest label sent in a telemetry label record / bytes
+const uint8_t MAX_TELEMETRY_LABEL_LENGTH = 48;
+// Largest telemetry record before encoding / bytes
+const uint8_t MAX_TELEMETRY_RECORD_LENGTH = 64;
+
+/* Shows a list of labelled values on the serial port.
+ *
+ * Values are held in fixed slots, so updating them doesn't touch the heap.
+ * Each slot keeps the raw value and its type, and values are only formatted
+ * when they're printed, so setting a value costs a store however often it's
+ * done. Register each value once (with its label in PROGMEM) to get a
+ * handle, then set the value through the handle as often as needed:
+ *
+ *   int distanceHandle = gDebugger->registerValue(F("distance / mm"));
+ *   ...
+ *   gDebugger->setValue(distanceHandle, distance);
+ *
+ * The original String keyed updateValue() calls still work, but look the
+ * slot up by label each time and the caller builds Strings to make them.
+ *
+ * On a VT100 terminal only the values that have changed are rewritten on
+ * each update (see SerialDisplay). Call requestFullRedraw() to draw
+ * everything again, e.g. after the terminal's been cleared.
+ *
+ * throttledPrintUpdate() never blocks on the serial port. Each update is
+ * composed a line at a time into the display's output buffer and only as
+ * much as Serial can take without waiting is sent, spread over as many
+ * calls as it takes, and each call stops once the output budget is spent.
+ *
+ * With the binaryTelemetry display type, updates are sent as binary records
+ * for a host to log rather than text (decode them with
+ * tools/telemetry_to_csv.py). Each record is COBS encoded and ends with a
+ * 0x00 byte. Before encoding it's a record type, the fields below (integers
+ * and floats are 4 bytes, little endian) and then a checksum byte, the low
+ * byte of the sum of all the bytes before it:
+ *
+ *   TELEMETRY_TIME:  time / ms since reset
+ *   TELEMETRY_LABEL: value handle, label text (no terminator)
+ *   TELEMETRY_VALUE: value handle, value type, value (bool is 1 byte, text
+ *                    is a length byte followed by the text)
+ *
+ * Each update is a time record followed by a value record for each value
+ * that's changed since the last one. Full updates (the first, and after
+ * requestFullRedraw()) send a label record and a value record for every
+ * value. User input isn't supported in this mode. */
 class SerialDebugger : public SerialDisplay {
 public:
-  SerialDebugger(unsigned long baud, bool getInput);
+  SerialDebugger(unsigned long baud, bool getInput, SerialDisplayType displayType);
+  SerialDebugger(unsigned long baud, bool getInput) : SerialDebugger(baud, getInput, SerialDisplayType::ansi_vt100) {};
   SerialDebugger(unsigned long baud) : SerialDebugger(baud, false) {};
 
+  /* Add a value to the display. The label must be in PROGMEM (i.e. use F()).
+   * Returns the handle to set it with, or -1 if there are already
+   * MAX_DEBUG_VALUES values. */
+  int registerValue(const __FlashStringHelper *label);
+  /* Set a registered value. These return false if the handle isn't valid.
+   * Note: Text isn't copied, so it must stay valid (e.g. a string literal) */
+  bool setValue(int handle, const char *value);
+  bool setValue(int handle, unsigned long value);
+  bool setValue(int handle, long value);
+  bool setValue(int handle, double value);
+  bool setValue(int handle, float value);
+  bool setValue(int handle, int value);
+  // Note: uint16_t is unsigned int on the AVR, so this one takes those
+  bool setValue(int handle, unsigned int value);
+  bool setValue(int handle, bool value);
+
   bool updateValue(String variable, String value);
   bool updateValue(String variable, unsigned long value);
   bool updateValue(String variable, double value);
   bool updateValue(String variable, float value);
   bool updateValue(String variable, int value);
-  
-  // Print an update but make sure it's not too often
+  bool updateValue(String variable, unsigned int value);
+
+  /* Print an update but make sure it's not too often. Call this every loop -
+   * it sends the update in progress without blocking, within the output
+   * budget. */
   void throttledPrintUpdate();
-  // Prints the update to screen
+  // Prints the update to screen, waiting until it's all been sent
   void printUpdate();
+  // Returns true if an update has been started but not all sent yet
+  bool isFrameInProgress();
+  // The most time throttledPrintUpdate() spends sending output each call / us
+  unsigned long getOutputBudget();
+  void setOutputBudget(unsigned long budgetUs);
+  // The time between updates from throttledPrintUpdate() / ms
+  unsigned long getUpdateInterval();
+  void setUpdateInterval(unsigned long intervalMs);
   // Get any additional user input since the last check. Non-blocking.
   void getAndProcessUserInputUpdates();
 
   unsigned long mNextPrintMillis = 0;
-  HashMap<String, String, MAX_DEBUG_VALUES> mStatusValues;
 
   /*******************************
    * Event handling
@@ -38,15 +128,61 @@ public:
 
 private:
 
+  // The type of value held in a slot
+  enum class DebugValueType : uint8_t {
+    none,
+    signedInteger,
+    unsignedInteger,
+    floatingPoint,
+    boolean,
+    text,
+    copiedText
+  };
+
+  // A value on the display
+  struct DebugSlot {
+    // The value's label - in PROGMEM if labelInFlash, otherwise in RAM
+    const char *label;
+    bool labelInFlash;
+    // Which of the value fields below is in use
+    DebugValueType type;
+    // The column the value starts at on its line
+    unsigned int valueColumn;
+    union {
+      long signedInteger;
+      unsigned long unsignedInteger;
+      float floatingPoint;
+      bool boolean;
+      const char *text;
+      char copiedText[MAX_DEBUG_VALUE_LENGTH];
+    } value;
+  };
+
   /*******************************
    * Member variables
    *******************************/
+  // The start of the line showing the time (in PROGMEM)
+  static const char TIME_PREFIX[];
+  // The values on the display, in the order they were registered
+  DebugSlot mSlots[MAX_DEBUG_VALUES];
+  // Number of values registered
+  uint8_t mSlotCount = 0;
   // The function to call if the user chooses to change one of the values added to this SerialDebugger
   volatile VoidFuncStringStringPtr mOnValueChangedHandlerFunction = nullptr;
   // If true then a value is currently being selected, if false then a new value is being selected
   bool mValueSelection = true;
   // If true, the this debugger will provide the ability for the user to change values
   bool mGetInput = false;
+  // The most time throttledPrintUpdate() spends sending output each call / us
+  unsigned long mOutputBudget = DEFAULT_DEBUG_OUTPUT_BUDGET_US;
+  // The time between updates from throttledPrintUpdate() / ms
+  unsigned long mUpdateInterval = DEFAULT_DEBUG_UPDATE_INTERVAL_MS;
+  // True while an update is being sent
+  bool mFrameInProgress = false;
+  // True if the update being sent redraws the whole display
+  bool mFrameIsFull = false;
+  // The next line of the update being sent to compose
+  uint8_t mFrameLine = 0;
 
   /*******************************
    * Private functions
@@ -55,9 +191,39 @@ private:
   bool handleRawSerialInput(String &inputValue);
   // Handle any user input received
   void processUserInput(String variable, String newValue);
-  // Updates values in the hashmap
-  bool internalUpdateValue(String variable, String value);
+  // Add a slot with the label supplied. Returns the handle, or -1 if there's no room.
+  int addSlot(const char *label, bool labelInFlash);
+  /* Find the slot for a String label, adding it (with a copy of the label) if
+   * it's not there already. Returns the handle, or -1 if there's no room. */
+  int findOrAddSlot(const String &variable);
+  // Get the slot for a handle (nullptr if the handle isn't valid)
+  DebugSlot* getSlot(int handle);
+  // Print a slot's label
+  void printLabel(const DebugSlot &slot);
+  // Format a slot's value for display, using the buffer supplied if needed. Returns the text.
+  const char* formatValue(const DebugSlot &slot, char *buffer);
+  // The label of a slot as a String (for value change handlers)
+  String labelString(const DebugSlot &slot);
+  // The display line a value is on
+  uint8_t valueLine(int handle);
+  // The prompt for user input
+  const __FlashStringHelper* prompt();
+  // Start sending an update
+  void startFrame();
+  /* Compose and send as much of the update in progress as Serial can take
+   * without blocking, within budgetUs. Returns true once it's all sent. */
+  bool sendFrame(unsigned long budgetUs);
+  // Compose a line of an update that redraws everything
+  void composeFullLine(uint8_t line);
+  // Compose a line of an update that only rewrites the time and the values that have changed
+  void composeChangedLine(uint8_t line);
+  // Compose the telemetry records for a line of an update
+  void composeTelemetryLine(uint8_t line, bool full);
+  // Add the checksum to a telemetry record and write it to the output. Returns false if it didn't fit.
+  bool writeTelemetryRecord(uint8_t *record, size_t length);
+  // Add a value to a telemetry record little endian. Returns the new record length.
+  size_t appendTelemetryLong(uint8_t *record, size_t length, uint32_t value);
 
 };
 
-#endif // __SERIALDEBUGGER_H_INCLUDED__
\ No newline at end of file
+#endif // __SERIALDEBUGGER_H_INCLUDED__
@@ -6,13 +6,117 @@ SerialDisplay::SerialDisplay(SerialDisplayType serialDisplayType) {
   mSerialDisplayType = serialDisplayType;
 }
 
+void SerialDisplay::requestFullRedraw() {
+  mFullRedraw = true;
+}
+
+SerialDisplayType SerialDisplay::getSerialDisplayType() {
+  return mSerialDisplayType;
+}
+
+bool SerialDisplay::supportsCursorPositioning() {
+  return mSerialDisplayType == SerialDisplayType::ansi_vt100;
+}
+
+bool SerialDisplay::isFullRedrawNeeded() {
+  return mFullRedraw || mSerialDisplayType == SerialDisplayType::serialMonitor;
+}
+
+bool SerialDisplay::isOutputEmpty() {
+  return mOutputSent == mOutputLength;
+}
+
+bool SerialDisplay::isLineDirty(uint8_t line) {
+  if (line >= SERIAL_DISPLAY_MAX_LINES) return true;
+  return mDirtyLines & ((uint32_t) 1 << line);
+}
+
 void SerialDisplay::clearSerialDisplay() {
   switch(mSerialDisplayType) {
     case SerialDisplayType::ansi_vt100:
-      Serial.print("\e[2J");
-      Serial.print("\e[H");
+      print("\e[2J");
+      print("\e[H");
       break;
     default:
       break;
   }
 }
+
+void SerialDisplay::moveCursor(uint8_t line, unsigned int column) {
+  if (!supportsCursorPositioning()) return;
+  // VT100 rows and columns count from 1
+  print("\e[");
+  print(line + 1);
+  print(';');
+  print(column + 1);
+  print('H');
+}
+
+void SerialDisplay::clearToEndOfLine() {
+  if (supportsCursorPositioning()) print("\e[K");
+}
+
+void SerialDisplay::markLineDirty(uint8_t line) {
+  if (line < SERIAL_DISPLAY_MAX_LINES) mDirtyLines |= (uint32_t) 1 << line;
+}
+
+void SerialDisplay::markLineClean(uint8_t line) {
+  if (line < SERIAL_DISPLAY_MAX_LINES) mDirtyLines &= ~((uint32_t) 1 << line);
+}
+
+void SerialDisplay::markAllLinesClean() {
+  mDirtyLines = 0;
+  mFullRedraw = false;
+}
+
+bool SerialDisplay::sendOutput(unsigned long startMicros, unsigned long budgetUs) {
+  while (mOutputSent < mOutputLength) {
+    if (micros() - startMicros >= budgetUs) return false;
+    // Only write what fits in the serial TX buffer, otherwise Serial.write() waits for space
+    size_t count = min((size_t) Serial.availableForWrite(), mOutputLength - mOutputSent);
+    if (count == 0) return false;
+    mOutputSent += Serial.write(mOutput + mOutputSent, count);
+  }
+  // All sent, so start filling from the beginning again
+  mOutputLength = 0;
+  mOutputSent = 0;
+  return true;
+}
+
+bool SerialDisplay::writeFrame(const uint8_t *data, size_t length) {
+  // Worst case, COBS adds a code byte for every 254 data bytes, plus the first one and the delimiter
+  if (mOutputLength + length + length / 254 + 2 > SERIAL_DISPLAY_OUTPUT_BUFFER_SIZE) return false;
+
+  /* Each zero in the frame is replaced by the distance to the next one (or
+   * the end of a 254 byte run), so the only zero on the wire is the
+   * delimiter and a receiver can always find the start of the next frame. */
+  size_t codeIndex = mOutputLength++;
+  uint8_t code = 1;
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] != 0) {
+      mOutput[mOutputLength++] = data[i];
+      code++;
+    }
+    if (data[i] == 0 || code == 0xFF) {
+      mOutput[codeIndex] = code;
+      codeIndex = mOutputLength++;
+      code = 1;
+    }
+  }
+  mOutput[codeIndex] = code;
+  mOutput[mOutputLength++] = 0;
+  return true;
+}
+
+size_t SerialDisplay::write(uint8_t data) {
+  if (mOutputLength >= SERIAL_DISPLAY_OUTPUT_BUFFER_SIZE) {
+    /* A line longer than the buffer (e.g. a very long label). Cutting it
+     * short would leave the display corrupted, so wait for Serial to take
+     * what's been composed so far and carry on from the start of the buffer. */
+    Serial.write(mOutput + mOutputSent, mOutputLength - mOutputSent);
+    mOutputLength = 0;
+    mOutputSent = 0;
+  }
+  mOutput[mOutputLength++] = data;
+  return 1;
+}
@@ -1,12 +1,35 @@
 #ifndef __SERIALDISPLAY_H_INCLUDED__
 #define __SERIALDISPLAY_H_INCLUDED__
 
+#include <Arduino.h>
+
+// The most lines a display can track changes on
+#define SERIAL_DISPLAY_MAX_LINES 32
+// Size of the buffer output is composed in before it's sent. Lines longer than this are sent blocking. / bytes
+#ifndef SERIAL_DISPLAY_OUTPUT_BUFFER_SIZE
+#define SERIAL_DISPLAY_OUTPUT_BUFFER_SIZE 128
+#endif
+// No limit on the time spent sending output
+static const unsigned long SERIAL_DISPLAY_NO_BUDGET = (unsigned long) -1;
+
 enum class SerialDisplayType {
   ansi_vt100,
-  serialMonitor
+  serialMonitor,
+  // COBS framed binary records for logging on a host (see SerialDebugger and tools/telemetry_to_csv.py)
+  binaryTelemetry
 };
 
-class SerialDisplay {
+/* Base for displays drawn on the serial port. On terminals that understand
+ * cursor positioning (ansi_vt100), lines are marked dirty as their content
+ * changes so a redraw only needs to rewrite those lines. Anything else gets
+ * a full redraw every time. Binary telemetry displays track changes the
+ * same way, so only what's changed needs sending.
+ *
+ * Output is printed into the display's own buffer (it's a Print) and sent
+ * with sendOutput(), which only writes as much as Serial can take without
+ * blocking. A line too long for the buffer is the exception - it's sent as
+ * it's printed, waiting for Serial. */
+class SerialDisplay : protected Print {
 
 public:
   /*******************************
@@ -14,12 +37,53 @@ public:
    *******************************/
   SerialDisplay(SerialDisplayType serialDisplayType);
 
+  /*******************************
+   * Actions
+   *******************************/
+  // Redraw the whole display next time rather than just the lines that have changed
+  void requestFullRedraw();
+
 protected:
+  /*******************************
+   * Getters / Setters
+   *******************************/
+  // The display type
+  SerialDisplayType getSerialDisplayType();
+  // Returns true if the display can move the cursor, i.e. it can be redrawn a line at a time
+  bool supportsCursorPositioning();
+  // Returns true if the next redraw needs to draw the whole display
+  bool isFullRedrawNeeded();
+  // Returns true if the line's content has changed since the last redraw (line 0 is the top)
+  bool isLineDirty(uint8_t line);
+  // Returns true if everything printed to the display has been sent
+  bool isOutputEmpty();
+
   /*******************************
    * Actions
    *******************************/
   // Clears down the serial display
   void clearSerialDisplay();
+  // Move the cursor to the start of a line (line 0 is the top) and column (column 0 is the left)
+  void moveCursor(uint8_t line, unsigned int column);
+  // Clear from the cursor to the end of the line
+  void clearToEndOfLine();
+  // Note that the line's content has changed
+  void markLineDirty(uint8_t line);
+  // Note that the line has been redrawn
+  void markLineClean(uint8_t line);
+  // Note that the display has been redrawn, so nothing has changed since
+  void markAllLinesClean();
+  /* Send as much of the output buffer as Serial can take without blocking,
+   * until budgetUs has passed since startMicros. Returns true once it's all
+   * been sent. */
+  bool sendOutput(unsigned long startMicros, unsigned long budgetUs);
+  /* COBS encode a frame into the output buffer, followed by the 0x00 frame
+   * delimiter. Returns false (and writes nothing) if it won't fit. */
+  bool writeFrame(const uint8_t *data, size_t length);
+  /* Print into the output buffer. If it's full, what's in it is sent first,
+   * waiting for Serial if need be, so only lines longer than the buffer block. */
+  size_t write(uint8_t data) override;
+  using Print::write;
 
 private:
   /*******************************
@@ -27,7 +91,17 @@ private:
    *******************************/
   // The display type
   SerialDisplayType mSerialDisplayType;
+  // One bit per line - set if the line has changed since the last redraw
+  uint32_t mDirtyLines = 0;
+  // If true, the whole display needs drawing next time
+  bool mFullRedraw = true;
+  // Output waiting to be sent
+  uint8_t mOutput[SERIAL_DISPLAY_OUTPUT_BUFFER_SIZE];
+  // Number of bytes in the output buffer
+  size_t mOutputLength = 0;
+  // Number of bytes of the output buffer already sent
+  size_t mOutputSent = 0;
 
 };
 
-#endif // __SERIALDISPLAY_H_INCLUDED__
\ No newline at end of file
+#endif // __SERIALDISPLAY_H_INCLUDED__
@@ -4,6 +4,7 @@
 #include "MULTIUART.hpp"
 #include "MUARTSingleStream.hpp"
 #include "A02YYUWviaUARTStream.hpp"
+#include "SensorArray.hpp"
 #include "SerialDebugger.hpp"
 
 /* Arduino Mega relevant pins from pinout diagram:
@@ -24,8 +25,16 @@ MUARTSingleStream* gStream2;
 A02YYUW::A02YYUWviaUARTStream* gSensor1;
 // The second UART communicating sensor we're using to test this interface
 A02YYUW::A02YYUWviaUARTStream* gSensor2;
+// Schedules reads across the sensors
+A02YYUW::SensorArray gSensorArray;
 // Debugger for output
 SerialDebugger* gDebugger;
+// Debugger value handles
+int gDistance1Handle;
+int gLastReadSuccess1Handle;
+int gDistance2Handle;
+int gLastReadSuccess2Handle;
+int gCurrentSlotHandle;
 
 /*******************
  * Utility functions
@@ -56,6 +65,9 @@ void setupSerial() {
 void setupDebugger() {
   // Set up debugger interface
   gDebugger = new SerialDebugger(115200);
+  // Or to log every reading to a host (decode with tools/telemetry_to_csv.py):
+  // gDebugger = new SerialDebugger(115200, false, SerialDisplayType::binaryTelemetry);
+  // gDebugger->setUpdateInterval(0);
 }
 
 // Setup for MULTIUART on its own
@@ -79,6 +91,8 @@ void singleStreamReaderSetup() {
 void sensor1Setup() {
   gStream1 = new MUARTSingleStream(&gMultiuart, 0);
   gStream1->begin(9600);
+  // Only poll the board when a whole packet could have arrived
+  gStream1->setExpectedBytes(A02YYUW::PACKET_SIZE);
   gSensor1 = new A02YYUW::A02YYUWviaUARTStream(gStream1, 8, true);
 
   setupDebugger();
@@ -94,7 +108,39 @@ void sensorsSetup() {
   gStream2->begin(9600);
   gSensor2 = new A02YYUW::A02YYUWviaUARTStream(gStream2, 9, true);
 
+  // The loop services both streams in one pass, so the sensors only ever need to read buffered data
+  gStream1->setAutoRefill(false);
+  gStream2->setAutoRefill(false);
+  gStream1->setExpectedBytes(A02YYUW::PACKET_SIZE);
+  gStream2->setExpectedBytes(A02YYUW::PACKET_SIZE);
+
   setupDebugger();
+  gDistance1Handle = gDebugger->registerValue(F("distance (1) / mm"));
+  gLastReadSuccess1Handle = gDebugger->registerValue(F("last successful read time (1) / ms since reset"));
+  gDistance2Handle = gDebugger->registerValue(F("distance (2) / mm"));
+  gLastReadSuccess2Handle = gDebugger->registerValue(F("last successful read time (2) / ms since reset"));
+}
+
+// Set up for 2 sensors read in turn by a sensor array
+void sensorArraySetup() {
+  gStream1 = new MUARTSingleStream(&gMultiuart, 0);
+  gStream1->begin(9600);
+  gStream1->setExpectedBytes(A02YYUW::PACKET_SIZE);
+  gSensor1 = new A02YYUW::A02YYUWviaUARTStream(gStream1, 8, true);
+
+  gStream2 = new MUARTSingleStream(&gMultiuart, 1);
+  gStream2->begin(9600);
+  gStream2->setExpectedBytes(A02YYUW::PACKET_SIZE);
+  gSensor2 = new A02YYUW::A02YYUWviaUARTStream(gStream2, 9, true);
+
+  // The streams refill themselves when read, so the board is only polled for a sensor during its slot
+  gSensorArray.addSensor(gSensor1);
+  gSensorArray.addSensor(gSensor2);
+
+  setupDebugger();
+  gDistance1Handle = gDebugger->registerValue(F("distance (1) / mm"));
+  gDistance2Handle = gDebugger->registerValue(F("distance (2) / mm"));
+  gCurrentSlotHandle = gDebugger->registerValue(F("current slot"));
 }
 
 void setup() {
@@ -105,11 +151,17 @@ void setup() {
   //SPI_CLOCK_DIV128 / SPI_CLOCK_DIV2 / SPI_CLOCK_DIV8 / SPI_CLOCK_DIV32
   // Set up the SPI and MultiUART Library
   gMultiuart.initialise(SPI_CLOCK_DIV64);
+  // To speed the SPI clock up as far as the wiring reliably allows, wire a spare UART's TX to its RX and tune against it, e.g.
+  // gMultiuart.SetBaud(3, 7);
+  // gMultiuart.autoTuneClock(3);
+  // Remember the UART baud rates across resets so setup doesn't rewrite the MULTIUART board's flash every boot
+  gMultiuart.enableBaudCache(0);
   
   // simpleDirectHexReaderSetup();
   // singleStreamReaderSetup();
   // sensor1Setup();
   sensorsSetup();
+  // sensorArraySetup();
 
 }
 
@@ -161,7 +213,7 @@ void sensor1Loop() {
   gSensor1->readDistance();
 
   // Lets see what we've got
-  gDebugger->updateValue("distance / mm", gSensor1->getDistance());
+  gDebugger->updateValue("distance / mm", gSensor1->getDistanceMM());
   gDebugger->updateValue("last read time / ms since reset", gSensor1->getLastReadTime());
   gDebugger->updateValue("last successful read time / ms since reset", gSensor1->getLastReadSuccess());
   gDebugger->updateValue("last read status", gSensor1->getLastReadStatus());
@@ -174,15 +226,32 @@ void sensor1Loop() {
 // Loop for 2 sensors
 void sensorsLoop() {
 
+  // Pull in whatever the sensors have sent in one sweep of the MULTIUART board
+  gMultiuart.serviceAll();
+
   // Update the latest distance reading on the sensors (self-throttling)
   gSensor1->readDistance();
   gSensor2->readDistance();
 
   // Lets see what we've got
-  gDebugger->updateValue("distance (1) / mm", gSensor1->getDistance());
-  gDebugger->updateValue("last successful read time (1) / ms since reset", gSensor1->getLastReadSuccess());
-  gDebugger->updateValue("distance (2) / mm", gSensor2->getDistance());
-  gDebugger->updateValue("last successful read time (2) / ms since reset", gSensor2->getLastReadSuccess());
+  gDebugger->setValue(gDistance1Handle, gSensor1->getDistanceMM());
+  gDebugger->setValue(gLastReadSuccess1Handle, gSensor1->getLastReadSuccess());
+  gDebugger->setValue(gDistance2Handle, gSensor2->getDistanceMM());
+  gDebugger->setValue(gLastReadSuccess2Handle, gSensor2->getLastReadSuccess());
+  gDebugger->throttledPrintUpdate();
+
+}
+
+// Loop for 2 sensors read in turn by a sensor array
+void sensorArrayLoop() {
+
+  // Read whichever sensor's turn it is
+  gSensorArray.service();
+
+  // Lets see what we've got
+  gDebugger->setValue(gDistance1Handle, gSensor1->getDistanceMM());
+  gDebugger->setValue(gDistance2Handle, gSensor2->getDistanceMM());
+  gDebugger->setValue(gCurrentSlotHandle, gSensorArray.getCurrentSlot());
   gDebugger->throttledPrintUpdate();
 
 }
@@ -193,5 +262,6 @@ void loop() {
   // singleStreamReaderLoop();
   // sensor1Loop();
   sensorsLoop();
+  // sensorArrayLoop();
 
 }
@@ -0,0 +1,38 @@
+/*****************
+Just enough of the Arduino API to build the MULTIUART core on the host for
+the native unit tests (pio test -e native). Time stands still and pin writes
+go nowhere.
+*****************/
+
+#ifndef __NATIVE_ARDUINO_H_INCLUDED__
+#define __NATIVE_ARDUINO_H_INCLUDED__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+inline int digitalRead(uint8_t) { return LOW; }
+inline unsigned long millis() { return 0; }
+inline unsigned long micros() { return 0; }
+inline void delay(unsigned long) {}
+inline void delayMicroseconds(unsigned int) {}
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#endif // __NATIVE_ARDUINO_H_INCLUDED__
@@ -0,0 +1,15 @@
+#ifndef __NATIVE_EEPROM_H_INCLUDED__
+#define __NATIVE_EEPROM_H_INCLUDED__
+
+#include <Arduino.h>
+
+// A blank (erased) EEPROM that forgets whatever is written to it
+class EEPROMClass {
+public:
+  uint8_t read(int) { return 0xFF; }
+  void update(int, uint8_t) {}
+};
+
+static EEPROMClass EEPROM __attribute__((unused));
+
+#endif // __NATIVE_EEPROM_H_INCLUDED__
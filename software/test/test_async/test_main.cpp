@@ -0,0 +1,226 @@
+/*****************
+Host tests for the MULTIUARTAsync command queue, run with pio test -e native.
+
+SimulatedBoard stands in for the SPI peripheral and the MULTIUART board. Each
+byte written is answered straight away following the board's SPI protocol,
+and poll() picks up the completion, so the queue moves one byte per poll()
+exactly as it would from the transfer complete interrupt.
+*****************/
+
+#include <unity.h>
+
+#include "MULTIUARTAsync.hpp"
+
+class SimulatedBoard : public MULTIUARTAsync {
+
+public:
+
+  SimulatedBoard() : MULTIUARTAsync(53) {}
+
+  // Bytes each UART has received, waiting to be read
+  uint8_t rxData[4][300];
+  size_t rxCount[4] = {0, 0, 0, 0};
+  size_t rxRead[4] = {0, 0, 0, 0};
+  // Bytes transmitted on each UART
+  uint8_t txData[4][600];
+  size_t txCount[4] = {0, 0, 0, 0};
+  // Number of bytes clocked over the bus
+  size_t transfers = 0;
+  // The state of the transfer complete interrupt enable
+  bool interruptEnabled = false;
+
+  void receive(char UART, const uint8_t *data, size_t length) {
+    memcpy(rxData[(uint8_t) UART] + rxCount[(uint8_t) UART], data, length);
+    rxCount[(uint8_t) UART] += length;
+  }
+
+  // Keep polling until the queue's empty, giving up if it never empties
+  bool runUntilIdle(size_t maxPolls = 10000) {
+    while (isBusy() && maxPolls-- > 0) poll();
+    return !isBusy();
+  }
+
+protected:
+
+  void writeSPIByte(uint8_t data) override {
+    transfers++;
+    mReceived = answer(data);
+    mComplete = true;
+  }
+
+  void setTransferInterrupt(bool enabled) override {
+    interruptEnabled = enabled;
+  }
+
+  bool isTransferComplete() override {
+    return mComplete;
+  }
+
+  uint8_t readSPIByte() override {
+    mComplete = false;
+    return mReceived;
+  }
+
+private:
+
+  enum class State : uint8_t { opcode, answer, length, payload };
+
+  State mState = State::opcode;
+  uint8_t mCommand = 0;
+  uint8_t mUART = 0;
+  uint8_t mRemaining = 0;
+  uint8_t mReceived = 0;
+  bool mComplete = false;
+
+  // The byte the board clocks back while the one given is clocked out
+  uint8_t answer(uint8_t data) {
+    switch (mState) {
+      case State::opcode:
+        mCommand = data & 0xF0;
+        mUART = data & 0x03;
+        mState = (mCommand == 0x10 || mCommand == 0x30) ? State::answer : State::length;
+        return 0xFF;
+      case State::answer:
+        mState = State::opcode;
+        if (mCommand == 0x10) return rxCount[mUART] - rxRead[mUART];
+        return 0;
+      case State::length:
+        mRemaining = data;
+        mState = mRemaining > 0 ? State::payload : State::opcode;
+        return 0xFF;
+      case State::payload:
+        if (--mRemaining == 0) mState = State::opcode;
+        if (mCommand == 0x20) return rxData[mUART][rxRead[mUART]++];
+        txData[mUART][txCount[mUART]++] = data;
+        return 0xFF;
+    }
+    return 0xFF;
+  }
+
+};
+
+// What the last completion callback was given
+static int sCallbacks;
+static char sLastUART;
+static size_t sLastResult;
+
+static void recordCompletion(void *context, char UART, size_t result) {
+  (void) context;
+  sCallbacks++;
+  sLastUART = UART;
+  sLastResult = result;
+}
+
+void setUp() {
+  sCallbacks = 0;
+  sLastUART = -1;
+  sLastResult = 0;
+}
+
+void tearDown() {}
+
+void test_checkRx_completes_from_poll() {
+  SimulatedBoard board;
+  const uint8_t data[] = {1, 2, 3};
+  board.receive(2, data, sizeof(data));
+
+  TEST_ASSERT_TRUE(board.checkRxAsync(2, recordCompletion, nullptr));
+  // Queuing only starts the first byte, the rest happens in poll()
+  TEST_ASSERT_EQUAL(0, sCallbacks);
+  TEST_ASSERT_TRUE(board.interruptEnabled);
+
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(1, sCallbacks);
+  TEST_ASSERT_EQUAL(2, sLastUART);
+  TEST_ASSERT_EQUAL(3, sLastResult);
+  TEST_ASSERT_FALSE(board.interruptEnabled);
+}
+
+void test_readBytes_reads_no_more_than_queued() {
+  SimulatedBoard board;
+  const uint8_t data[] = {0x11, 0x22, 0x33, 0x44};
+  board.receive(1, data, sizeof(data));
+  uint8_t buffer[10];
+  memset(buffer, 0, sizeof(buffer));
+
+  TEST_ASSERT_TRUE(board.readBytesAsync(buffer, 1, sizeof(buffer), recordCompletion, nullptr));
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(4, sLastResult);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, buffer, sizeof(data));
+  TEST_ASSERT_EQUAL(0, buffer[4]);
+}
+
+void test_readBytes_with_nothing_queued_completes_with_zero() {
+  SimulatedBoard board;
+  uint8_t buffer[4];
+
+  TEST_ASSERT_TRUE(board.readBytesAsync(buffer, 0, sizeof(buffer), recordCompletion, nullptr));
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(1, sCallbacks);
+  TEST_ASSERT_EQUAL(0, sLastResult);
+}
+
+void test_transmit_longer_than_one_frame_is_split() {
+  SimulatedBoard board;
+  uint8_t data[MULTIUART_MAX_TRANSFER + 45];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = i;
+
+  TEST_ASSERT_TRUE(board.transmitBytesAsync(3, data, sizeof(data), recordCompletion, nullptr));
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(1, sCallbacks);
+  TEST_ASSERT_EQUAL(sizeof(data), sLastResult);
+  TEST_ASSERT_EQUAL(sizeof(data), board.txCount[3]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(data, board.txData[3], sizeof(data));
+  // Two frames, each an opcode and a length byte before the data
+  TEST_ASSERT_EQUAL(sizeof(data) + 4, board.transfers);
+}
+
+void test_zero_length_transmit_completes_from_poll() {
+  SimulatedBoard board;
+  const uint8_t data[] = {0};
+
+  TEST_ASSERT_TRUE(board.transmitBytesAsync(0, data, 0, recordCompletion, nullptr));
+  TEST_ASSERT_EQUAL(0, sCallbacks);
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(1, sCallbacks);
+  TEST_ASSERT_EQUAL(0, sLastResult);
+  TEST_ASSERT_EQUAL(0, board.txCount[0]);
+}
+
+void test_commands_complete_in_order() {
+  SimulatedBoard board;
+  const uint8_t data[] = {7, 8};
+  board.receive(0, data, sizeof(data));
+
+  TEST_ASSERT_TRUE(board.checkTxAsync(1, recordCompletion, nullptr));
+  TEST_ASSERT_TRUE(board.checkRxAsync(0, recordCompletion, nullptr));
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(2, sCallbacks);
+  TEST_ASSERT_EQUAL(0, sLastUART);
+  TEST_ASSERT_EQUAL(2, sLastResult);
+}
+
+void test_full_queue_and_bad_channel_are_refused() {
+  SimulatedBoard board;
+  for (uint8_t i = 0; i < MULTIUART_ASYNC_QUEUE_SIZE; i++) {
+    TEST_ASSERT_TRUE(board.checkRxAsync(0, recordCompletion, nullptr));
+  }
+  TEST_ASSERT_FALSE(board.checkRxAsync(0, recordCompletion, nullptr));
+  TEST_ASSERT_FALSE(board.checkRxAsync(-1, recordCompletion, nullptr));
+  TEST_ASSERT_FALSE(board.checkRxAsync(4, recordCompletion, nullptr));
+
+  TEST_ASSERT_TRUE(board.runUntilIdle());
+  TEST_ASSERT_EQUAL(MULTIUART_ASYNC_QUEUE_SIZE, sCallbacks);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_checkRx_completes_from_poll);
+  RUN_TEST(test_readBytes_reads_no_more_than_queued);
+  RUN_TEST(test_readBytes_with_nothing_queued_completes_with_zero);
+  RUN_TEST(test_transmit_longer_than_one_frame_is_split);
+  RUN_TEST(test_zero_length_transmit_completes_from_poll);
+  RUN_TEST(test_commands_complete_in_order);
+  RUN_TEST(test_full_queue_and_bad_channel_are_refused);
+  return UNITY_END();
+}
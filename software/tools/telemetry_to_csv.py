@@ -0,0 +1,147 @@
+#!/usr/bin/env python3
+"""Decode SerialDebugger binary telemetry into CSV.
+
+SerialDebugger's binaryTelemetry display type sends COBS encoded records,
+each ending with a 0x00 byte (see SerialDebugger.hpp for the format). This
+turns a capture of that serial output into CSV with a row per update: the
+time followed by a column per value. Values are only sent when they change,
+so each row carries the last value seen for every column.
+
+Usage:
+  telemetry_to_csv.py capture.bin > capture.csv
+  cat /dev/ttyACM0 | telemetry_to_csv.py --long > capture.csv
+
+--long writes a row per value sent (time, handle, label, value) as the
+records arrive instead, which suits live streams as the columns don't need
+to be known up front.
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+TELEMETRY_TIME = 0x01
+TELEMETRY_LABEL = 0x02
+TELEMETRY_VALUE = 0x03
+
+TELEMETRY_TYPE_NONE = 0
+TELEMETRY_TYPE_SIGNED = 1
+TELEMETRY_TYPE_UNSIGNED = 2
+TELEMETRY_TYPE_FLOAT = 3
+TELEMETRY_TYPE_BOOL = 4
+TELEMETRY_TYPE_TEXT = 5
+
+
+def cobs_decode(data):
+    """Decode one COBS encoded frame (without its 0x00 delimiter)."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            raise ValueError("bad COBS code")
+        out += data[i + 1:i + code]
+        i += code
+        # A code below 0xFF stands in for a zero, except at the end of the frame
+        if code < 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def read_frames(stream):
+    """Yield the decoded records from a binary stream, skipping bad ones."""
+    pending = bytearray()
+    while True:
+        # read1() returns whatever has arrived rather than waiting for a full 4 KiB
+        chunk = stream.read1(4096)
+        if not chunk:
+            break
+        pending += chunk
+        while True:
+            end = pending.find(0)
+            if end < 0:
+                break
+            frame = bytes(pending[:end])
+            del pending[:end + 1]
+            if not frame:
+                continue
+            try:
+                record = cobs_decode(frame)
+            except ValueError:
+                continue
+            if len(record) < 2 or sum(record[:-1]) & 0xFF != record[-1]:
+                # Corrupt, or joined part way through a record
+                continue
+            yield record[:-1]
+
+
+def decode_value(record):
+    """Returns (handle, value) from a value record, or None if it's too short
+    for its type (corrupted, but passed the 8-bit checksum by chance)."""
+    handle, value_type = record[1], record[2]
+    payload = record[3:]
+    if value_type in (TELEMETRY_TYPE_SIGNED, TELEMETRY_TYPE_UNSIGNED, TELEMETRY_TYPE_FLOAT):
+        if len(payload) < 4:
+            return None
+        fmt = {TELEMETRY_TYPE_SIGNED: "<i", TELEMETRY_TYPE_UNSIGNED: "<I", TELEMETRY_TYPE_FLOAT: "<f"}[value_type]
+        return handle, struct.unpack(fmt, payload[:4])[0]
+    if value_type == TELEMETRY_TYPE_BOOL:
+        if len(payload) < 1:
+            return None
+        return handle, bool(payload[0])
+    if value_type == TELEMETRY_TYPE_TEXT:
+        if len(payload) < 1 or len(payload) < 1 + payload[0]:
+            return None
+        return handle, payload[1:1 + payload[0]].decode("ascii", "replace")
+    return handle, ""
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("capture", nargs="?", help="binary capture file (default: stdin)")
+    parser.add_argument("--long", action="store_true", help="write a row per value as it arrives")
+    args = parser.parse_args()
+
+    stream = open(args.capture, "rb") if args.capture else sys.stdin.buffer
+    writer = csv.writer(sys.stdout)
+
+    labels = {}
+    values = {}
+    rows = []
+    time = None
+
+    if args.long:
+        writer.writerow(["time / ms", "handle", "label", "value"])
+
+    for record in read_frames(stream):
+        kind = record[0]
+        if kind == TELEMETRY_TIME and len(record) >= 5:
+            if time is not None and not args.long:
+                rows.append((time, dict(values)))
+            time = struct.unpack("<I", record[1:5])[0]
+        elif kind == TELEMETRY_LABEL and len(record) >= 2:
+            labels[record[1]] = record[2:].decode("ascii", "replace")
+        elif kind == TELEMETRY_VALUE and len(record) >= 3:
+            decoded = decode_value(record)
+            if decoded is None:
+                continue
+            handle, value = decoded
+            values[handle] = value
+            if args.long:
+                writer.writerow([time, handle, labels.get(handle, ""), value])
+                sys.stdout.flush()
+
+    if args.long:
+        return
+    if time is not None:
+        rows.append((time, dict(values)))
+
+    handles = sorted(set(labels) | set(values))
+    writer.writerow(["time / ms"] + [labels.get(h, "value %d" % h) for h in handles])
+    for row_time, row_values in rows:
+        writer.writerow([row_time] + [row_values.get(h, "") for h in handles])
+
+
+if __name__ == "__main__":
+    main()